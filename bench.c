@@ -0,0 +1,426 @@
+// bench.c
+//
+// In-process microbenchmark for the serve_* handlers. Builds a dataset in a temporary
+// directory, opens the same subsystems the server opens at startup, then calls each
+// handler directly in a loop, with no sockets and no other processes. Reports per
+// handler: ns/op, syscalls/op (calls through the sys_* wrappers, counted when utils.c is
+// built with -DCOUNT_SYSCALLS), heap allocations/op and reply bytes/op, as JSON on stdout
+// so runs from different builds can be diffed.
+//
+// Build: gcc -O2 -DCOUNT_SYSCALLS -o bench bench.c utils.c -lpthread
+//
+// Each handler call is followed by journal_flush(), as handle_client() does after every
+// request, so journal writes are charged to the request that produced them.
+
+#include <sys/socket.h> // For socketpair (-r socket)
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>       // For clock_gettime
+#include <unistd.h>     // For getopt, chdir, rmdir
+#include <dirent.h>     // For opendir (temp directory cleanup)
+
+#include "utils.h"
+#include "structs.h"
+
+#ifndef COUNT_SYSCALLS
+#error "Build bench.c and utils.c with -DCOUNT_SYSCALLS"
+#endif
+
+#define DEFAULT_CUSTOMERS 10000
+#define DEFAULT_LOANS 10000
+#define DEFAULT_MIN_MS 200       // Measured time per handler
+#define BATCH 64                 // Calls between clock reads
+#define EMPLOYEE_ID 2
+#define FIRST_CUSTOMER 3
+
+
+// ====================================================================
+// I. ALLOCATION COUNTING (malloc family interposed on glibc's allocator)
+// ====================================================================
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static uint64_t alloc_count = 0;
+
+void *malloc(size_t size) { alloc_count++; return __libc_malloc(size); }
+void *calloc(size_t nmemb, size_t size) { alloc_count++; return __libc_calloc(nmemb, size); }
+void *realloc(void *ptr, size_t size) { alloc_count++; return __libc_realloc(ptr, size); }
+void free(void *ptr) { __libc_free(ptr); }
+
+
+// ====================================================================
+// II. REPLY SINKS
+// ====================================================================
+// null:   a reply hook that only counts bytes (no syscall)
+// socket: replies go out through sys_write/sys_writev on one end of a socketpair, as in
+//         fork mode; the other end is drained after every call with a raw read, which
+//         is timed but not counted as a handler syscall
+
+static uint64_t reply_bytes = 0;
+static int sink_sd = -1;  // Handler side of the socketpair, or -1 with the null hook
+static int drain_sd = -1;
+
+static ssize_t null_sink(int client_sd, const void *buf, size_t len) {
+    (void)client_sd;
+    (void)buf;
+    reply_bytes += len;
+    return (ssize_t)len;
+}
+
+static void drain_replies(void) {
+    char buf[65536];
+    ssize_t n;
+    while ((n = recv(drain_sd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) reply_bytes += n;
+}
+
+
+// ====================================================================
+// III. DATASET
+// ====================================================================
+
+static int num_customers = DEFAULT_CUSTOMERS;
+static int num_loans = DEFAULT_LOANS;
+
+static int write_all(const char *path, const void *buf, size_t len) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1) return -1;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, (const char *)buf + done, len - done);
+        if (n <= 0) { close(fd); return -1; }
+        done += n;
+    }
+    return close(fd);
+}
+
+// Admin (1), one employee (2), then customers with $1M each and loans spread over them
+static int build_dataset(void) {
+    int users = FIRST_CUSTOMER - 1 + num_customers;
+    struct User *u = calloc(users, sizeof(struct User));
+    struct Account *a = calloc(users, sizeof(struct Account));
+    struct Loan *l = calloc(num_loans > 0 ? num_loans : 1, sizeof(struct Loan));
+    if (u == NULL || a == NULL || l == NULL) return -1;
+
+    u[0] = (struct User){ 1, ADMINISTRATOR, "admin", "adminpass", "Admin User", 40, "HQ" };
+    u[1] = (struct User){ EMPLOYEE_ID, EMPLOYEE, "emp1", "emppass", "Bank Employee 1", 30, "Branch A" };
+    for (int id = 1; id <= users; id++) {
+        a[id - 1] = (struct Account){ id, 0.0, DEACTIVATED, 0 };
+        if (id < FIRST_CUSTOMER) continue;
+        u[id - 1].id = id;
+        u[id - 1].role = CUSTOMER;
+        sprintf(u[id - 1].username, "cust%d", id);
+        sprintf(u[id - 1].password, "cust%dpass", id);
+        strcpy(u[id - 1].name, "Bench Customer");
+        u[id - 1].age = 30;
+        a[id - 1] = (struct Account){ id, 1000000.0, ACTIVE, 0 };
+    }
+    for (int i = 0; i < num_loans; i++) {
+        l[i] = (struct Loan){ i + 1, FIRST_CUSTOMER + i % num_customers, 5000.0, 12, LOAN_APPLIED, 0 };
+    }
+
+    int rc = 0;
+    if (write_all("users.dat", u, users * sizeof(struct User)) == -1 ||
+        write_all("accounts.dat", a, users * sizeof(struct Account)) == -1 ||
+        write_all("loans.dat", l, num_loans * sizeof(struct Loan)) == -1) {
+        rc = -1;
+    }
+    free(u);
+    free(a);
+    free(l);
+    return rc;
+}
+
+static void remove_dir(const char *path) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) return;
+    struct dirent *entry;
+    char name[512];
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        snprintf(name, sizeof(name), "%s/%s", path, entry->d_name);
+        unlink(name);
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+
+// ====================================================================
+// IV. BENCHMARK CASES
+// ====================================================================
+// Cases run in table order. Read-only cases come first and the ones that grow files
+// (loans.dat, users.dat) last, so earlier cases see the dataset as built.
+
+static uint32_t rng = 12345;
+
+static int pick_customer(void) {
+    rng = rng * 1664525u + 1013904223u;
+    return FIRST_CUSTOMER + (int)((rng >> 8) % (uint32_t)num_customers);
+}
+
+static void req_balance(struct Message *m, uint64_t i) {
+    (void)i;
+    m->command = CMD_VIEW_BALANCE;
+    m->source_id = pick_customer();
+}
+
+static void req_deposit(struct Message *m, uint64_t i) {
+    (void)i;
+    m->command = CMD_DEPOSIT;
+    m->source_id = pick_customer();
+    m->amount = 1.0;
+}
+
+static void req_withdraw(struct Message *m, uint64_t i) {
+    (void)i;
+    m->command = CMD_WITHDRAW;
+    m->source_id = pick_customer();
+    m->amount = 1.0;
+}
+
+static void req_transfer(struct Message *m, uint64_t i) {
+    (void)i;
+    m->command = CMD_TRANSFER;
+    m->source_id = pick_customer();
+    do { m->target_id = pick_customer(); } while (m->target_id == m->source_id && num_customers > 1);
+    m->amount = 1.0;
+}
+
+static void req_history(struct Message *m, uint64_t i) {
+    (void)i;
+    m->command = CMD_VIEW_HISTORY;
+    m->source_id = pick_customer();
+}
+
+static void req_loan_status(struct Message *m, uint64_t i) {
+    (void)i;
+    m->command = CMD_VIEW_LOAN_STATUS;
+    m->source_id = pick_customer();
+}
+
+static void req_assigned_loans(struct Message *m, uint64_t i) {
+    (void)i;
+    m->command = CMD_VIEW_ASSIGNED_LOANS;
+    m->source_id = EMPLOYEE_ID;
+}
+
+static void req_process_loan(struct Message *m, uint64_t i) {
+    m->command = CMD_PROCESS_LOAN;
+    m->source_id = EMPLOYEE_ID;
+    m->target_id = (num_loans > 0) ? 1 + (int)(i % num_loans) : 1;
+    m->amount = LOAN_PROCESSED;
+}
+
+static void req_modify_customer(struct Message *m, uint64_t i) {
+    (void)i;
+    m->command = CMD_MODIFY_CUSTOMER;
+    m->target_id = pick_customer();
+    strcpy(m->data, "Bench Customer");
+    strcpy(m->data + MAX_NAME_LEN, "31");
+    strcpy(m->data + MAX_NAME_LEN + 10, "1 Bench Street");
+}
+
+static void req_apply_loan(struct Message *m, uint64_t i) {
+    (void)i;
+    m->command = CMD_APPLY_LOAN;
+    m->source_id = pick_customer();
+    m->amount = 5000.0;
+    m->target_id = 12;
+}
+
+static void req_add_customer(struct Message *m, uint64_t i) {
+    m->command = CMD_ADD_CUSTOMER;
+    m->source_id = EMPLOYEE_ID;
+    sprintf(m->data, "bench%llu", (unsigned long long)i);
+    strcpy(m->data + MAX_NAME_LEN, "benchpass");
+}
+
+static const struct {
+    const char *name;
+    void (*build)(struct Message *m, uint64_t i);
+    void (*serve)(int client_sd, struct Message *request);
+} cases[] = {
+    { "serve_view_balance", req_balance, serve_view_balance },
+    { "serve_deposit", req_deposit, serve_deposit },
+    { "serve_withdraw", req_withdraw, serve_withdraw },
+    { "serve_transfer", req_transfer, serve_transfer },
+    { "serve_view_history", req_history, serve_view_history },
+    { "serve_view_loan_status", req_loan_status, serve_view_loan_status },
+    { "serve_view_assigned_loans", req_assigned_loans, serve_view_assigned_loans },
+    { "serve_process_loan", req_process_loan, serve_process_loan },
+    { "serve_modify_customer", req_modify_customer, serve_modify_customer },
+    { "serve_apply_loan", req_apply_loan, serve_apply_loan },
+    { "serve_add_customer", req_add_customer, serve_add_customer },
+};
+#define NUM_CASES (int)(sizeof(cases) / sizeof(cases[0]))
+
+struct CaseResult {
+    uint64_t iterations;
+    uint64_t ns;
+    uint64_t syscalls;
+    uint64_t allocs;
+    uint64_t bytes;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t iteration = 0; // Across cases, so generated usernames never repeat
+
+static void run_batch(int c, int n) {
+    struct Message request;
+    for (int k = 0; k < n; k++) {
+        memset(&request, 0, sizeof(request));
+        cases[c].build(&request, iteration++);
+        cases[c].serve(sink_sd, &request);
+        journal_flush();
+        if (drain_sd != -1) drain_replies();
+    }
+}
+
+static void run_case(int c, uint64_t min_ns, uint64_t warmup, struct CaseResult *out) {
+    run_batch(c, (int)warmup);
+
+    uint64_t syscalls0 = sys_call_count, allocs0 = alloc_count, bytes0 = reply_bytes;
+    uint64_t start = now_ns(), elapsed = 0, iterations = 0;
+    while (elapsed < min_ns) {
+        run_batch(c, BATCH);
+        iterations += BATCH;
+        elapsed = now_ns() - start;
+    }
+    out->iterations = iterations;
+    out->ns = elapsed;
+    out->syscalls = sys_call_count - syscalls0;
+    out->allocs = alloc_count - allocs0;
+    out->bytes = reply_bytes - bytes0;
+}
+
+
+// ====================================================================
+// V. DRIVER
+// ====================================================================
+
+static int selected(const char *list, const char *name) {
+    if (list == NULL) return 1;
+    size_t len = strlen(name);
+    for (const char *p = list; (p = strstr(p, name)) != NULL; p += len) {
+        if ((p == list || p[-1] == ',') && (p[len] == '\0' || p[len] == ',')) return 1;
+    }
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n customers] [-l loans] [-t ms] [-w warmup] [-r null|socket]\n", prog);
+    fprintf(stderr, "          [-s none|async|sync] [-d parent_dir] [-b handler,...] [-k]\n");
+    fprintf(stderr, "  -n N     customers in the dataset (default %d)\n", DEFAULT_CUSTOMERS);
+    fprintf(stderr, "  -l N     loans in the dataset (default %d)\n", DEFAULT_LOANS);
+    fprintf(stderr, "  -t MS    minimum measured time per handler (default %d)\n", DEFAULT_MIN_MS);
+    fprintf(stderr, "  -w N     unmeasured warm-up calls per handler (default %d)\n", BATCH);
+    fprintf(stderr, "  -r SINK  reply sink: null (reply hook, default) or socket (socketpair)\n");
+    fprintf(stderr, "  -s POL   account store durability, as server -s (default none)\n");
+    fprintf(stderr, "  -d DIR   where to create the temporary dataset directory (default /tmp)\n");
+    fprintf(stderr, "  -b LIST  only these handlers, e.g. serve_deposit,serve_transfer\n");
+    fprintf(stderr, "  -k       keep the dataset directory\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *parent = "/tmp", *only = NULL, *sink = "null";
+    int min_ms = DEFAULT_MIN_MS, warmup = BATCH, durability = STORE_SYNC_NONE, keep = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:l:t:w:r:s:d:b:kh")) != -1) {
+        switch (opt) {
+            case 'n': num_customers = atoi(optarg); break;
+            case 'l': num_loans = atoi(optarg); break;
+            case 't': min_ms = atoi(optarg); break;
+            case 'w': warmup = atoi(optarg); break;
+            case 'r': sink = optarg; break;
+            case 'd': parent = optarg; break;
+            case 'b': only = optarg; break;
+            case 'k': keep = 1; break;
+            case 's':
+                if (strcmp(optarg, "none") == 0) durability = STORE_SYNC_NONE;
+                else if (strcmp(optarg, "async") == 0) durability = STORE_SYNC_ASYNC;
+                else if (strcmp(optarg, "sync") == 0) durability = STORE_SYNC_FULL;
+                else { usage(argv[0]); exit(EXIT_FAILURE); }
+                break;
+            default:
+                usage(argv[0]);
+                exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (num_customers < 2 || num_loans < 0 || min_ms < 1 || warmup < 0 ||
+        (strcmp(sink, "null") != 0 && strcmp(sink, "socket") != 0)) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // Handlers and startup code log with sys_write_string on fd 1; keep that off the JSON
+    FILE *json = fdopen(dup(1), "w");
+    if (json == NULL || dup2(2, 1) == -1) {
+        perror("[BENCH] stdout");
+        exit(EXIT_FAILURE);
+    }
+
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s/bankbench.XXXXXX", parent);
+    if (mkdtemp(dir) == NULL || chdir(dir) == -1) {
+        perror("[BENCH] Temp directory");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "[BENCH] Dataset in %s: %d customers, %d loans\n", dir, num_customers, num_loans);
+
+    // Same startup sequence as the server
+    if (build_dataset() == -1 || lock_table_open() == -1 || store_open(durability) == -1 ||
+        user_index_open() == -1 || id_allocator_open() == -1 || wal_open(0) == -1 || journal_open() == -1) {
+        perror("[BENCH] Setup failed");
+        remove_dir(dir);
+        exit(EXIT_FAILURE);
+    }
+
+    if (strcmp(sink, "socket") == 0) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+            perror("[BENCH] socketpair");
+            exit(EXIT_FAILURE);
+        }
+        sink_sd = sv[0];
+        drain_sd = sv[1];
+    } else {
+        set_reply_hook(null_sink);
+    }
+
+    fprintf(json, "{\n  \"benchmark\": \"serve_handlers\",\n");
+    fprintf(json, "  \"config\": {\"customers\": %d, \"loans\": %d, \"min_ms\": %d, \"warmup\": %d, \"sink\": \"%s\", \"durability\": %d},\n",
+           num_customers, num_loans, min_ms, warmup, sink, durability);
+    fprintf(json, "  \"results\": [");
+    int first = 1;
+    for (int c = 0; c < NUM_CASES; c++) {
+        if (!selected(only, cases[c].name)) continue;
+        struct CaseResult r;
+        fprintf(stderr, "[BENCH] %s\n", cases[c].name);
+        run_case(c, (uint64_t)min_ms * 1000000, warmup, &r);
+        fprintf(json, "%s\n    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.1f, \"syscalls_per_op\": %.2f, "
+               "\"allocs_per_op\": %.2f, \"reply_bytes_per_op\": %.1f}",
+               first ? "" : ",", cases[c].name, (unsigned long long)r.iterations,
+               (double)r.ns / r.iterations, (double)r.syscalls / r.iterations,
+               (double)r.allocs / r.iterations, (double)r.bytes / r.iterations);
+        fflush(json);
+        first = 0;
+    }
+    fprintf(json, "\n  ]\n}\n");
+    fclose(json);
+
+    if (!keep) remove_dir(dir);
+    return 0;
+}
@@ -1,12 +1,16 @@
 // client.c
 
 #include <sys/socket.h>
+#include <sys/un.h>     // For sockaddr_un (-u)
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>  // For O_RDONLY (payroll files)
 #include <stdlib.h> // For exit, atoi, atof
 #include <stdio.h>  // For sprintf (TEMPORARY - MUST BE REPLACED)
 #include <string.h> // For strncpy
+#include <time.h>   // For strftime (transaction timestamps)
+#include <unistd.h> // For getopt
 
 #include "utils.h"
 #include "structs.h"
@@ -16,18 +20,52 @@
 
 // Global variable for the connected socket descriptor
 int server_sd = -1;
+static struct Pipeline pipeline; // Every request and reply goes through it (utils.c XII)
+static const char *unix_path = NULL; // -u: connect to the server's local socket instead of TCP
+static int use_ring = 0;             // -r: then move onto a shared-memory ring
+static char session_token[SESSION_TOKEN_LEN + 1]; // From the last login; resumes it after a reconnect
 
 // Function declarations
 int connect_to_server();
 void client_login_flow(int role);
 void customer_menu_handler();
 void employee_menu_handler(); // New handler for Employee
+void admin_menu_handler();
+void manager_menu_handler();
+void print_server_stats();
+void print_lock_stats();
+void print_history_pages(int account_id);
+void print_loan_status(int customer_id);
+void print_loan_pages(int status, int assignee);
+void run_batch_transfer();
 // ... other menu handlers
 
 // CRITICAL FIX: The definition of current_user is in utils.c.
 // We rely on the extern declaration in structs.h to access it.
 
-int connect_to_server() {
+static int connect_local() {
+    struct sockaddr_un addr = {};
+
+    if (strlen(unix_path) >= sizeof(addr.sun_path)) {
+        sys_write_string("[CLIENT] Local socket path too long\n");
+        return -1;
+    }
+    server_sd = sys_socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server_sd < 0) {
+        perror("[CLIENT] Socket creation failed");
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, unix_path);
+    if (sys_connect(server_sd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("[CLIENT] Connection Failed");
+        sys_close(server_sd);
+        return -1;
+    }
+    return 0;
+}
+
+static int connect_tcp() {
     struct sockaddr_in server_addr;
 
     server_sd = sys_socket(AF_INET, SOCK_STREAM, 0);
@@ -50,10 +88,67 @@ int connect_to_server() {
         sys_close(server_sd);
         return -1;
     }
+    return 0;
+}
+
+int connect_to_server() {
+    if (((unix_path != NULL) ? connect_local() : connect_tcp()) == -1) return -1;
+    pipeline_init(&pipeline, server_sd);
+    if (pipeline_negotiate(&pipeline) == -1) {
+        sys_write_string("[CLIENT] Server closed the connection.\n");
+        sys_close(server_sd);
+        return -1;
+    }
+    if (use_ring && pipeline_attach_ring(&pipeline) == -1) {
+        sys_write_string("[CLIENT] Server refused the shared-memory ring; staying on the socket.\n");
+    }
     sys_write_string("[CLIENT] Connected to the Bank Server.\n");
     return 0;
 }
 
+// Opens a new connection after the old one dropped and, if someone was logged in,
+// resumes their session with its token instead of asking for the password again.
+static int reconnect_to_server() {
+    struct Message request, response;
+
+    pipeline_free(&pipeline);
+    sys_close(server_sd);
+    if (connect_to_server() != 0) return -1;
+    if (current_user.id == 0) return 0;
+
+    memset(&request, 0, sizeof(request));
+    request.command = CMD_RESUME;
+    strcpy(request.data, session_token);
+    if (session_token[0] == '\0' || pipeline_queue(&pipeline, &request) == 0 || pipeline_flush(&pipeline) == -1 ||
+        pipeline_reply(&pipeline, &response, NULL, 0) == -1 || !response.success_status) {
+        sys_write_string("[CLIENT] Session could not be resumed; please log in again.\n");
+        current_user.id = 0;
+        session_token[0] = '\0';
+        return 0;
+    }
+    sys_write_string("[CLIENT] Session resumed.\n");
+    return 0;
+}
+
+// Sends one request and waits for its reply. Up to max bytes of the records that follow
+// the reply are copied to records; returns their full size, or -1 (with a failed
+// response) if the connection is gone. A lost connection is reopened, but the request
+// is not sent again: it may already have taken effect.
+static ssize_t transact(struct Message *request, struct Message *response, void *records, size_t max) {
+    ssize_t got = -1;
+    if (pipeline_queue(&pipeline, request) != 0 && pipeline_flush(&pipeline) == 0) {
+        got = pipeline_reply(&pipeline, response, records, max);
+    }
+    if (got == -1) {
+        memset(response, 0, sizeof(*response));
+        strcpy(response->data, "Connection lost.");
+        if (reconnect_to_server() == 0) strcpy(response->data, "Connection lost and reopened; check before retrying.");
+    } else if (request->command == CMD_LOGOUT) {
+        session_token[0] = '\0';
+    }
+    return got;
+}
+
 void client_login_flow(int role) {
     char username[MAX_NAME_LEN];
     char password[MAX_PASS_LEN];
@@ -65,23 +160,195 @@ void client_login_flow(int role) {
     sys_write_string("Password: ");
     get_input(password, MAX_PASS_LEN);
 
+    memset(&request, 0, sizeof(request));
     request.command = CMD_LOGIN;
     request.source_id = role; 
     strncpy(request.data, username, MAX_NAME_LEN);
     strncpy(request.data + MAX_NAME_LEN, password, MAX_PASS_LEN);
     
-    sys_write(server_sd, &request, sizeof(struct Message));
-    sys_read(server_sd, &response, sizeof(struct Message));
+    transact(&request, &response, NULL, 0);
 
     if (response.success_status) {
         sys_write_string("✅ Login Successful!\n");
         current_user.id = response.source_id; 
         current_user.role = role;
+        strncpy(session_token, response.data, SESSION_TOKEN_LEN); // Empty if the server issues none
+        session_token[SESSION_TOKEN_LEN] = '\0';
     } else {
         sys_write_string("❌ Login Failed: Invalid credentials or deactivated account.\n");
     }
 }
 
+static const char *transaction_type_name(int type) {
+    switch (type) {
+        case TXN_DEPOSIT: return "Deposit";
+        case TXN_WITHDRAW: return "Withdraw";
+        case TXN_TRANSFER_OUT: return "Transfer Out";
+        case TXN_TRANSFER_IN: return "Transfer In";
+        case TXN_INTEREST: return "Interest";
+        default: return "Unknown";
+    }
+}
+
+// Reads an optional YYYY-MM-DD date as microseconds at the start of that local day.
+// Returns 0 for blank or unparsable input (no bound).
+static long long read_date(const char *prompt) {
+    char date_str[20];
+    struct tm day = {};
+
+    sys_write_string(prompt);
+    get_input(date_str, sizeof(date_str));
+    if (sscanf(date_str, "%d-%d-%d", &day.tm_year, &day.tm_mon, &day.tm_mday) != 3) return 0;
+    day.tm_year -= 1900;
+    day.tm_mon -= 1;
+    day.tm_isdst = -1;
+    time_t secs = mktime(&day);
+    return (secs == (time_t)-1) ? 0 : (long long)secs * 1000000;
+}
+
+// Fetches an account's history newest first, one page at a time, asking before each
+// further page.
+void print_history_pages(int account_id) {
+    struct Message request, response;
+    struct Transaction page[HISTORY_PAGE_RECORDS];
+    struct HistoryRange range;
+    int cursor = 0, shown = 0;
+    char line[200], answer[10];
+
+    range.from = read_date("From date (YYYY-MM-DD, blank for all): ");
+    range.to = read_date("To date (YYYY-MM-DD, blank for all): ");
+    if (range.to != 0) range.to += 24LL * 3600 * 1000000 - 1; // Through the end of that day
+
+    do {
+        memset(&request, 0, sizeof(request));
+        request.command = CMD_VIEW_HISTORY;
+        request.source_id = account_id;
+        request.target_id = cursor;
+        memcpy(request.data, &range, sizeof(range));
+        ssize_t got = transact(&request, &response, page, sizeof(page));
+        if (!response.success_status) {
+            sys_write_string("❌ ");
+            sys_write_string(response.data);
+            sys_write_string("\n");
+            return;
+        }
+        if (response.target_id < 0 || response.target_id > HISTORY_PAGE_RECORDS ||
+            (size_t)got != response.target_id * sizeof(struct Transaction)) {
+            return;
+        }
+
+        if (shown == 0 && response.target_id > 0) {
+            sys_write_string("ID         Time                 Type          Amount        Other Account\n");
+        }
+        for (int i = 0; i < response.target_id; i++) {
+            char when[32];
+            time_t secs = (time_t)(page[i].timestamp / 1000000);
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&secs));
+            if (page[i].type == TXN_TRANSFER_OUT || page[i].type == TXN_TRANSFER_IN) {
+                sprintf(line, "%-10d %-20s %-13s %-13.2f %d\n", page[i].id, when,
+                        transaction_type_name(page[i].type), page[i].amount, page[i].target_account_id);
+            } else {
+                sprintf(line, "%-10d %-20s %-13s %-13.2f -\n", page[i].id, when,
+                        transaction_type_name(page[i].type), page[i].amount);
+            }
+            sys_write_string(line);
+        }
+        shown += response.target_id;
+        cursor = response.source_id;
+
+        if (cursor != 0) {
+            sys_write_string("Show more? (y/n): ");
+            get_input(answer, sizeof(answer));
+            if (answer[0] != 'y' && answer[0] != 'Y') break;
+        }
+    } while (cursor != 0);
+
+    if (shown == 0) sys_write_string("ℹ️ No transactions found.\n");
+}
+
+// Lists loans in a status (and of an assignee) a page at a time, asking before each
+// further page.
+void print_loan_pages(int status, int assignee) {
+    static struct Loan page[LOAN_PAGE_RECORDS];
+    struct Message request, response;
+    struct LoanQuery query = { status, assignee, 0, 0 };
+    int shown = 0;
+    char line[200], answer[10];
+
+    do {
+        memset(&request, 0, sizeof(request));
+        request.command = CMD_LIST_LOANS;
+        memcpy(request.data, &query, sizeof(query));
+        ssize_t got = transact(&request, &response, page, sizeof(page));
+        if (!response.success_status) {
+            sys_write_string("❌ ");
+            sys_write_string(response.data);
+            sys_write_string("\n");
+            return;
+        }
+        if (response.target_id < 0 || response.target_id > LOAN_PAGE_RECORDS ||
+            (size_t)got != response.target_id * sizeof(struct Loan)) {
+            return;
+        }
+
+        if (shown == 0 && response.target_id > 0) {
+            sys_write_string("Loan ID    Customer   Amount        Tenure  Assignee\n");
+        }
+        for (int i = 0; i < response.target_id; i++) {
+            sprintf(line, "%-10d %-10d %-13.2f %-7d %d\n", page[i].id, page[i].customer_id,
+                    page[i].amount, page[i].tenure_months, page[i].processed_by_id);
+            sys_write_string(line);
+        }
+        shown += response.target_id;
+        query.cursor_id = response.source_id;
+        query.cursor_seq = (unsigned int)response.amount;
+
+        if (query.cursor_id != 0) {
+            sys_write_string("Show more? (y/n): ");
+            get_input(answer, sizeof(answer));
+            if (answer[0] != 'y' && answer[0] != 'Y') break;
+        }
+    } while (query.cursor_id != 0);
+
+    if (shown == 0) sys_write_string("ℹ️ No matching loans.\n");
+}
+
+// Lists the customer's loans, newest first, from one reply.
+void print_loan_status(int customer_id) {
+    static struct Loan loans[LOAN_STATUS_MAX_RECORDS];
+    struct Message request, response;
+    char line[200];
+
+    memset(&request, 0, sizeof(request));
+    request.command = CMD_VIEW_LOAN_STATUS;
+    request.source_id = customer_id;
+    ssize_t got = transact(&request, &response, loans, sizeof(loans));
+    if (!response.success_status) {
+        sys_write_string("ℹ️ ");
+        sys_write_string(response.data);
+        sys_write_string("\n");
+        return;
+    }
+    if (response.target_id < 0 || response.target_id > LOAN_STATUS_MAX_RECORDS ||
+        (size_t)got != response.target_id * sizeof(struct Loan)) {
+        return;
+    }
+
+    sys_write_string("Loan ID    Amount        Tenure  Status\n");
+    for (int i = 0; i < response.target_id; i++) {
+        const char *status = "REJECTED";
+        if (loans[i].status == LOAN_APPLIED) status = "APPLIED (Pending)";
+        else if (loans[i].status == LOAN_PROCESSED) status = "PROCESSED (Awaiting Final Approval)";
+        else if (loans[i].status == LOAN_APPROVED) status = "APPROVED";
+        sprintf(line, "%-10d %-13.2f %-7d %s\n", loans[i].id, loans[i].amount, loans[i].tenure_months, status);
+        sys_write_string(line);
+    }
+    if (response.source_id > response.target_id) {
+        sprintf(line, "(newest %d of %d loans shown)\n", response.target_id, response.source_id);
+        sys_write_string(line);
+    }
+}
+
 void customer_menu_handler() {
     char choice_str[10];
     int choice;
@@ -91,13 +358,13 @@ void customer_menu_handler() {
         print_menu(CUSTOMER);
         get_input(choice_str, sizeof(choice_str));
         choice = atoi(choice_str);
+        memset(&request, 0, sizeof(request)); // Unused fields stay off the wire
 
         switch (choice) {
             case 1: // View Balance
                 request.command = CMD_VIEW_BALANCE;
                 request.source_id = current_user.id;
-                sys_write(server_sd, &request, sizeof(struct Message));
-                sys_read(server_sd, &response, sizeof(struct Message));
+                transact(&request, &response, NULL, 0);
                 
                 if (response.success_status) {
                     char balance_output[100];
@@ -122,8 +389,7 @@ void customer_menu_handler() {
                     request.source_id = current_user.id;
                     request.amount = amount;
                     
-                    sys_write(server_sd, &request, sizeof(struct Message));
-                    sys_read(server_sd, &response, sizeof(struct Message));
+                    transact(&request, &response, NULL, 0);
                     
                     if (response.success_status) {
                         char output[150];
@@ -158,8 +424,7 @@ void customer_menu_handler() {
                     request.target_id = target_id; 
                     request.amount = amount;
                     
-                    sys_write(server_sd, &request, sizeof(struct Message));
-                    sys_read(server_sd, &response, sizeof(struct Message));
+                    transact(&request, &response, NULL, 0);
                     
                     if (response.success_status) {
                         char output[200];
@@ -194,8 +459,7 @@ void customer_menu_handler() {
                     request.amount = amount;
                     request.target_id = tenure; // Repurposing target_id for tenure
                     
-                    sys_write(server_sd, &request, sizeof(struct Message));
-                    sys_read(server_sd, &response, sizeof(struct Message));
+                    transact(&request, &response, NULL, 0);
                     
                     if (response.success_status) {
                         sys_write_string("✅ ");
@@ -210,31 +474,20 @@ void customer_menu_handler() {
                 break;
             
             case 6: // View Loan Status (Customer Option 6 in PDF is Feedback, but View Status is more immediate)
-                {
-                    request.command = CMD_VIEW_LOAN_STATUS;
-                    request.source_id = current_user.id;
-                    
-                    sys_write(server_sd, &request, sizeof(struct Message));
-                    sys_read(server_sd, &response, sizeof(struct Message));
-                    
-                    if (response.success_status) {
-                        sys_write_string("✅ Loan Status: ");
-                        sys_write_string(response.data);
-                        sys_write_string("\n");
-                    } else {
-                        sys_write_string("ℹ️ ");
-                        sys_write_string(response.data);
-                        sys_write_string("\n");
-                    }
-                }
+                print_loan_status(current_user.id);
                 break;
             
-            // Note: Option 7 is View Transaction History (TBD)
+            case 7: // View Transaction History
+                print_history_pages(current_user.id);
+                break;
             
-            case 9: // Logout
+            case 8: // Batch Transfer
+                run_batch_transfer();
+                break;
+
+            case 10: // Logout
                 request.command = CMD_LOGOUT;
-                sys_write(server_sd, &request, sizeof(struct Message));
-                sys_read(server_sd, &response, sizeof(struct Message));
+                transact(&request, &response, NULL, 0);
                 
                 if (response.success_status) {
                     sys_write_string("Logging out...\n");
@@ -244,7 +497,7 @@ void customer_menu_handler() {
                 }
                 break;
                 
-            case 10: // Exit
+            case 11: // Exit
                 sys_write_string("Exiting system. Goodbye!\n");
                 sys_close(server_sd);
                 exit(0);
@@ -255,6 +508,118 @@ void customer_menu_handler() {
     }
 }
 
+// Reads "target_account amount" lines (blank lines and # comments skipped) into legs.
+// Returns the number of legs, or -1 with a message printed.
+static int read_payroll_file(const char *path, struct TransferLeg *legs, int max) {
+    int fd = sys_open(path, O_RDONLY);
+    if (fd == -1) {
+        sys_write_string("❌ Cannot open payroll file.\n");
+        return -1;
+    }
+    size_t len = 0, cap = 1 << 16;
+    char *text = malloc(cap + 1);
+    ssize_t got;
+    while (text != NULL && (got = sys_read(fd, text + len, cap - len)) > 0) {
+        len += got;
+        if (len == cap) {
+            char *grown = realloc(text, 2 * cap + 1);
+            if (grown == NULL) { free(text); text = NULL; break; }
+            text = grown;
+            cap *= 2;
+        }
+    }
+    sys_close(fd);
+    if (text == NULL) return -1;
+    text[len] = '\0';
+
+    int n = 0, line_no = 0;
+    for (char *line = text, *next; line != NULL && *line != '\0'; line = next) {
+        next = strchr(line, '\n');
+        if (next != NULL) *next++ = '\0';
+        line_no++;
+        char *p = line, *end;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '\0' || *p == '#' || *p == '\r') continue;
+
+        long target = strtol(p, &end, 10);
+        double amount = (end != p) ? strtod(end, &p) : 0;
+        if (end == p || n == max) {
+            char msg[100];
+            sprintf(msg, n == max ? "❌ More than %d payments in the file.\n" : "❌ Bad line %d in payroll file.\n",
+                    n == max ? max : line_no);
+            sys_write_string(msg);
+            free(text);
+            return -1;
+        }
+        legs[n].target_id = (int)target;
+        legs[n].status = 0;
+        legs[n].amount = amount;
+        n++;
+    }
+    free(text);
+    return n;
+}
+
+// Pays every line of a payroll file from the customer's account as one CMD_BATCH_TRANSFER.
+void run_batch_transfer() {
+    char path[256], line[200];
+    struct Message request, response;
+    struct TransferLeg *legs = malloc(BATCH_MAX_LEGS * sizeof(struct TransferLeg));
+    if (legs == NULL) return;
+
+    sys_write_string("Enter payroll file (one \"account amount\" per line): ");
+    get_input(path, sizeof(path));
+    int n = read_payroll_file(path, legs, BATCH_MAX_LEGS);
+    if (n <= 0) {
+        if (n == 0) sys_write_string("❌ Payroll file has no payments.\n");
+        free(legs);
+        return;
+    }
+
+    // Pipeline every frame into one write; only the last one is answered
+    memset(&request, 0, sizeof(request));
+    request.command = CMD_BATCH_TRANSFER;
+    request.source_id = current_user.id;
+    request.target_id = n;
+    for (int sent = 0; sent < n; sent += BATCH_FRAME_LEGS) {
+        int take = (n - sent < BATCH_FRAME_LEGS) ? n - sent : BATCH_FRAME_LEGS;
+        memcpy(request.data, legs + sent, take * sizeof(struct TransferLeg));
+        pipeline_queue(&pipeline, &request);
+    }
+    ssize_t got = (pipeline_flush(&pipeline) == -1) ? -1 :
+                  pipeline_reply(&pipeline, &response, legs, n * sizeof(struct TransferLeg));
+    if (got == -1) {
+        sys_write_string("❌ Connection lost.\n");
+        free(legs);
+        return;
+    }
+    int count = response.target_id;
+    if (count < 0 || count > n || (size_t)got != count * sizeof(struct TransferLeg)) {
+        sys_write_string("❌ Malformed batch reply.\n");
+        free(legs);
+        return;
+    }
+
+    if (response.success_status) {
+        sprintf(line, "✅ Paid %d accounts, %.2f in total. New Balance: %.2f\n", n, response.amount,
+                response.account_data.balance);
+        sys_write_string(line);
+    } else {
+        sys_write_string("❌ Batch Transfer Failed: ");
+        sys_write_string(response.data);
+        sys_write_string("\n");
+        for (int i = 0; i < count; i++) {
+            const char *why = (legs[i].status == LEG_NO_ACCOUNT) ? "no such account" :
+                              (legs[i].status == LEG_BAD_AMOUNT) ? "amount must be positive" :
+                              (legs[i].status == LEG_SELF) ? "cannot pay your own account" : NULL;
+            if (why == NULL) continue;
+            sprintf(line, "   Payment %d to account %d (%.2f): %s\n", i + 1, legs[i].target_id, legs[i].amount, why);
+            sys_write_string(line);
+        }
+    }
+    free(legs);
+}
+
 void employee_menu_handler() {
     char choice_str[10];
     int choice;
@@ -264,6 +629,7 @@ void employee_menu_handler() {
         print_menu(EMPLOYEE);
         get_input(choice_str, sizeof(choice_str));
         choice = atoi(choice_str);
+        memset(&request, 0, sizeof(request)); // Unused fields stay off the wire
 
         switch (choice) {
             case 1: // Add New Customer
@@ -282,8 +648,7 @@ void employee_menu_handler() {
                     strncpy(request.data, username, MAX_NAME_LEN);
                     strncpy(request.data + MAX_NAME_LEN, password, MAX_PASS_LEN);
                     
-                    sys_write(server_sd, &request, sizeof(struct Message));
-                    sys_read(server_sd, &response, sizeof(struct Message));
+                    transact(&request, &response, NULL, 0);
                     
                     if (response.success_status) {
                         sys_write_string("✅ ");
@@ -300,7 +665,7 @@ void employee_menu_handler() {
             case 2: // Modify Customer Details
                 {
                     char target_id_str[10];
-                    char new_name[MAX_NAME_LEN], new_age_str[10], new_address[100];
+                    char new_name[MAX_NAME_LEN], new_age_str[10], new_address[100], new_username[MAX_NAME_LEN];
                     int target_id;
                     
                     sys_write_string("--- Modify Customer Details ---\n");
@@ -314,8 +679,10 @@ void employee_menu_handler() {
                     get_input(new_age_str, 10);
                     sys_write_string("Enter NEW Address: ");
                     get_input(new_address, 100);
+                    sys_write_string("Enter NEW Username (blank to keep): ");
+                    get_input(new_username, MAX_NAME_LEN);
 
-                    // Package data: [Name\0][Age_str\0][Address\0]
+                    // Package data: [Name\0][Age_str\0][Address\0][Username\0]
                     request.command = CMD_MODIFY_CUSTOMER;
                     request.target_id = target_id;
                     
@@ -325,9 +692,10 @@ void employee_menu_handler() {
                     strncpy(request.data + MAX_NAME_LEN, new_age_str, 10);
                     // Copy Address (starts at offset MAX_NAME_LEN + 10)
                     strncpy(request.data + MAX_NAME_LEN + 10, new_address, 100);
+                    // Copy optional new Username (starts at offset MAX_NAME_LEN + 110)
+                    strncpy(request.data + MAX_NAME_LEN + 10 + 100, new_username, MAX_NAME_LEN);
                     
-                    sys_write(server_sd, &request, sizeof(struct Message));
-                    sys_read(server_sd, &response, sizeof(struct Message));
+                    transact(&request, &response, NULL, 0);
                     
                     if (response.success_status) {
                         sys_write_string("✅ ");
@@ -346,8 +714,7 @@ void employee_menu_handler() {
                     request.command = CMD_VIEW_ASSIGNED_LOANS;
                     request.source_id = current_user.id;
                     
-                    sys_write(server_sd, &request, sizeof(struct Message));
-                    sys_read(server_sd, &response, sizeof(struct Message));
+                    transact(&request, &response, NULL, 0);
                     
                     if (response.success_status) {
                         sys_write_string("ℹ️ Loans Summary: ");
@@ -358,9 +725,27 @@ void employee_menu_handler() {
                         sys_write_string(response.data);
                         sys_write_string("\n");
                     }
+
+                    char status_str[10], assignee_str[10];
+                    sys_write_string("List loans in status (1 Applied, 2 Processed, 3 Approved, 4 Rejected, blank = no): ");
+                    get_input(status_str, sizeof(status_str));
+                    if (atoi(status_str) == 0) break;
+                    sys_write_string("Assigned to (blank = you, 0 = unassigned, * = anyone, or an employee ID): ");
+                    get_input(assignee_str, sizeof(assignee_str));
+                    print_loan_pages(atoi(status_str), (assignee_str[0] == '\0') ? current_user.id :
+                                     (assignee_str[0] == '*') ? LOAN_ANY_ASSIGNEE : atoi(assignee_str));
                 }
                 break;
             
+            case 6: // View Customer Transactions
+                {
+                    char account_id_str[10];
+                    sys_write_string("Enter Customer Account ID: ");
+                    get_input(account_id_str, sizeof(account_id_str));
+                    print_history_pages(atoi(account_id_str));
+                }
+                break;
+
             case 3: // Process Loan Applications (Intermediate review)
             case 4: // Approve/Reject Loans (Final decision)
                 {
@@ -370,9 +755,28 @@ void employee_menu_handler() {
                     sys_write_string("--- Loan Processing ---\n");
                     
                     // Option 5 should be run first to see pending loans
-                    sys_write_string("Enter Loan ID to process/change status: ");
+                    sys_write_string((choice == 3) ? "Enter Loan ID to process (0 = claim the next one): "
+                                                   : "Enter Loan ID to process/change status: ");
                     get_input(loan_id_str, sizeof(loan_id_str));
                     loan_id = atoi(loan_id_str);
+
+                    if (choice == 3 && loan_id == 0) {
+                        // Take the next loan from the work queue, then review it as usual
+                        request.command = CMD_CLAIM_LOAN;
+                        request.source_id = current_user.id;
+                        transact(&request, &response, NULL, 0);
+                        sys_write_string(response.success_status ? "📥 " : "ℹ️ ");
+                        sys_write_string(response.data);
+                        sys_write_string("\n");
+                        if (!response.success_status) break;
+                        loan_id = response.target_id;
+
+                        char answer[10];
+                        sys_write_string("Mark it as PROCESSED now? (y/n): ");
+                        get_input(answer, sizeof(answer));
+                        if (answer[0] != 'y' && answer[0] != 'Y') break;
+                        memset(&request, 0, sizeof(request));
+                    }
                     
                     if (choice == 3) {
                          // Process/Review (Intermediate status)
@@ -395,8 +799,7 @@ void employee_menu_handler() {
                     request.target_id = loan_id;
                     request.amount = (double)action_code; // Repurpose amount for action code
                     
-                    sys_write(server_sd, &request, sizeof(struct Message));
-                    sys_read(server_sd, &response, sizeof(struct Message));
+                    transact(&request, &response, NULL, 0);
 
                     if (response.success_status) {
                         sys_write_string("✅ ");
@@ -412,8 +815,7 @@ void employee_menu_handler() {
 
             case 8: // Logout
                 request.command = CMD_LOGOUT;
-                sys_write(server_sd, &request, sizeof(struct Message));
-                sys_read(server_sd, &response, sizeof(struct Message));
+                transact(&request, &response, NULL, 0);
                 
                 if (response.success_status) {
                     sys_write_string("Logging out...\n");
@@ -435,9 +837,229 @@ void employee_menu_handler() {
 }
 
 
-int main() {
+// Fetches the server's per-command statistics and prints one row per command.
+void print_server_stats() {
+    struct Message request, response;
+    struct CommandStats stats[32];
+    char line[256];
+
+    memset(&request, 0, sizeof(request));
+    request.command = CMD_STATS;
+    request.source_id = current_user.id;
+    ssize_t got = transact(&request, &response, stats, sizeof(stats));
+    if (!response.success_status) {
+        sys_write_string("❌ Failed to retrieve statistics: ");
+        sys_write_string(response.data);
+        sys_write_string("\n");
+        return;
+    }
+
+    int count = response.target_id;
+    if (count < 0 || count > 32 || (size_t)got != count * sizeof(struct CommandStats)) {
+        sys_write_string("❌ Malformed statistics reply.\n");
+        return;
+    }
+    sprintf(line, "%-20s %10s %8s %10s %10s %10s %10s %12s %12s\n", "Command", "Requests", "Errors",
+            "p50 (us)", "p99 (us)", "p99.9 (us)", "Max (us)", "Lock wait(us)", "Bytes out");
+    sys_write_string(line);
+    for (int i = 0; i < count; i++) {
+        struct CommandStats *c = &stats[i];
+        sprintf(line, "%-20s %10llu %8llu %10.1f %10.1f %10.1f %10.1f %12.1f %12llu\n",
+                command_name(c->command), c->count, c->errors, c->p50_ns / 1000.0, c->p99_ns / 1000.0,
+                c->p999_ns / 1000.0, c->max_ns / 1000.0, c->lock_wait_ns / 1000.0, c->bytes_out);
+        sys_write_string(line);
+    }
+}
+
+// Fetches the server's lock contention profile: totals per lock space, then its hottest records.
+void print_lock_stats() {
+    struct Message request, response;
+    struct LockSpaceStats spaces[8];
+    struct LockHotspot hot[8 * LOCK_HOTSPOTS_REPORTED];
+    char records[sizeof(spaces) + sizeof(hot)];
+    char line[256];
+
+    memset(&request, 0, sizeof(request));
+    request.command = CMD_LOCK_STATS;
+    request.source_id = current_user.id;
+    ssize_t got = transact(&request, &response, records, sizeof(records));
+    if (!response.success_status) {
+        sys_write_string("❌ Failed to retrieve lock statistics: ");
+        sys_write_string(response.data);
+        sys_write_string("\n");
+        return;
+    }
+
+    int nspaces = response.source_id, count = response.target_id;
+    if (nspaces < 0 || nspaces > 8 || count < 0 || count > 8 * LOCK_HOTSPOTS_REPORTED ||
+        (size_t)got != nspaces * sizeof(struct LockSpaceStats) + count * sizeof(struct LockHotspot)) {
+        sys_write_string("❌ Malformed lock statistics reply.\n");
+        return;
+    }
+    memcpy(spaces, records, nspaces * sizeof(struct LockSpaceStats));
+    memcpy(hot, records + nspaces * sizeof(struct LockSpaceStats), count * sizeof(struct LockHotspot));
+    sprintf(line, "%-10s %14s %12s %14s\n", "Space", "Acquired", "Contended", "Wait (us)");
+    sys_write_string(line);
+    for (int i = 0; i < nspaces; i++) {
+        sprintf(line, "%-10s %14llu %12llu %14.1f\n", lock_space_name(spaces[i].space),
+                spaces[i].acquisitions, spaces[i].contended, spaces[i].wait_ns / 1000.0);
+        sys_write_string(line);
+    }
+    if (count == 0) {
+        sys_write_string("No contended records.\n");
+        return;
+    }
+    sprintf(line, "\n%-10s %10s %10s %14s %12s\n", "Space", "Record", "Waits", "Wait (us)", "+/- (us)");
+    sys_write_string(line);
+    for (int i = 0; i < count; i++) {
+        sprintf(line, "%-10s %10d %10llu %14.1f %12.1f\n", lock_space_name(hot[i].space), hot[i].record,
+                hot[i].waits, hot[i].wait_ns / 1000.0, hot[i].error_ns / 1000.0);
+        sys_write_string(line);
+    }
+}
+
+void admin_menu_handler() {
+    char choice_str[10];
+    char input[20];
+    int choice;
+    struct Message request, response;
+
+    while (current_user.id != 0) {
+        print_menu(ADMINISTRATOR);
+        get_input(choice_str, sizeof(choice_str));
+        choice = atoi(choice_str);
+        memset(&request, 0, sizeof(request)); // Unused fields stay off the wire
+
+        switch (choice) {
+            case 4: // View Server Statistics
+                print_server_stats();
+                break;
+
+            case 5: // View Lock Contention
+                print_lock_stats();
+                break;
+
+            case 6: // Run End-of-Day Interest Accrual
+                sys_write_string("Annual interest rate in percent (0 = show the latest run): ");
+                get_input(input, sizeof(input));
+                request.amount = atof(input);
+                if (request.amount > 0) {
+                    sys_write_string("Business day YYYYMMDD (blank = today): ");
+                    get_input(input, sizeof(input));
+                    request.target_id = atoi(input);
+                }
+                request.command = CMD_ACCRUE_INTEREST;
+                transact(&request, &response, NULL, 0);
+                sys_write_string(response.success_status ? "✅ " : "❌ ");
+                sys_write_string(response.data[0] ? response.data : "Request refused.");
+                sys_write_string("\n");
+                break;
+
+            case 8: // Logout
+                request.command = CMD_LOGOUT;
+                transact(&request, &response, NULL, 0);
+                
+                if (response.success_status) {
+                    sys_write_string("Logging out...\n");
+                    current_user.id = 0; 
+                } else {
+                    sys_write_string("❌ Logout failed on server.\n");
+                }
+                break;
+                
+            case 9: // Exit
+                sys_write_string("Exiting system. Goodbye!\n");
+                sys_close(server_sd);
+                exit(0);
+
+            default:
+                sys_write_string("Option is not yet implemented.\n");
+        }
+    }
+}
+
+void manager_menu_handler() {
+    char choice_str[10];
+    char input[20];
+    int choice;
+    struct Message request, response;
+
+    while (current_user.id != 0) {
+        print_menu(MANAGER);
+        get_input(choice_str, sizeof(choice_str));
+        choice = atoi(choice_str);
+        memset(&request, 0, sizeof(request)); // Unused fields stay off the wire
+
+        switch (choice) {
+            case 1: // Activate/Deactivate Customer Accounts
+                sys_write_string("Customer account ID: ");
+                get_input(input, sizeof(input));
+                request.source_id = atoi(input);
+                sys_write_string("1. Activate  0. Deactivate: ");
+                get_input(input, sizeof(input));
+                request.target_id = (atoi(input) == 1) ? ACTIVE : DEACTIVATED;
+                request.command = CMD_SET_ACCOUNT_STATUS;
+                transact(&request, &response, NULL, 0);
+                sys_write_string(response.success_status ? "✅ " : "❌ ");
+                sys_write_string(response.data[0] ? response.data : "Request refused.");
+                sys_write_string("\n");
+                break;
+
+            case 2: // Assign Loan Application Processes to Employees
+                sys_write_string("How many queued loan applications to assign (0 = all): ");
+                get_input(input, sizeof(input));
+                request.command = CMD_ASSIGN_LOANS;
+                request.target_id = atoi(input);
+                transact(&request, &response, NULL, 0);
+                sys_write_string(response.success_status ? "✅ " : "❌ ");
+                sys_write_string(response.data[0] ? response.data : "Request refused.");
+                sys_write_string("\n");
+                break;
+
+            case 5: // Logout
+                request.command = CMD_LOGOUT;
+                transact(&request, &response, NULL, 0);
+
+                if (response.success_status) {
+                    sys_write_string("Logging out...\n");
+                    current_user.id = 0;
+                } else {
+                    sys_write_string("❌ Logout failed on server.\n");
+                }
+                break;
+
+            case 6: // Exit
+                sys_write_string("Exiting system. Goodbye!\n");
+                sys_close(server_sd);
+                exit(0);
+
+            default:
+                sys_write_string("Option is not yet implemented.\n");
+        }
+    }
+}
+
+
+int main(int argc, char *argv[]) {
     char choice_str[10];
     int choice = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "u:rh")) != -1) {
+        switch (opt) {
+            case 'u': unix_path = optarg; break;
+            case 'r': use_ring = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-u path [-r]]\n", argv[0]);
+                fprintf(stderr, "  -u PATH  connect to the server's local socket (server -u) instead of TCP\n");
+                fprintf(stderr, "  -r       then exchange messages over a shared-memory ring\n");
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+    if (use_ring && unix_path == NULL) {
+        fprintf(stderr, "%s: -r needs -u\n", argv[0]);
+        return 1;
+    }
 
     if (connect_to_server() != 0) {
         sys_write_string("Could not start client. Exiting.\n");
@@ -469,7 +1091,12 @@ int main() {
                         case EMPLOYEE:
                             employee_menu_handler();
                             break;
-                        // TODO: Add handlers for Manager, Admin
+                        case MANAGER:
+                            manager_menu_handler();
+                            break;
+                        case ADMINISTRATOR:
+                            admin_menu_handler();
+                            break;
                         default:
                             sys_write_string("[CLIENT] Role menu not yet implemented.\n");
                             current_user.id = 0; 
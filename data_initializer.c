@@ -1,56 +1,439 @@
 // data_initializer.c
+//
+// With no options, writes the small test dataset: admin, one employee and two customers.
+// With -c/-e/-l/-t it also generates a bulk synthetic dataset on top of those records:
+//   - customers with log-normal balances; a small set of hot accounts holds far more;
+//   - loans whose borrowers follow a Zipf distribution, in a mix of statuses;
+//   - transaction journal segments whose accounts follow the same Zipf distribution.
+// Every record is a pure function of (seed, record number), so the output does not depend
+// on the thread count. Each file is sized up front and split into contiguous ranges, one
+// per thread, and every thread fills a large buffer and writes it with one pwrite.
+//
+// Build: gcc -O2 -o init data_initializer.c -lpthread -lm
 
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>   // For strtoll, atof, exit
+#include <stdint.h>
+#include <math.h>     // For pow, exp, log, sqrt
+#include <pthread.h>
+#include <time.h>     // For time (transaction timestamps)
+#include <dirent.h>
 #include "structs.h"
 
 #define USERS_FILE "users.dat"
 #define ACCOUNTS_FILE "accounts.dat"
+#define LOANS_FILE "loans.dat"
+#define JOURNAL_PREFIX "transactions"        // Must match utils.c (section IX)
+#define JOURNAL_SEGMENT_RECORDS (1u << 20)   // Must match utils.c (section IX)
 
-int main() {
-    // 1. Setup Admin (ID 1)
-    struct User admin = {1, ADMINISTRATOR, "admin", "adminpass", "Admin User", 40, "HQ"};
-
-    // 2. Setup Employee (ID 2)
-    struct User employee = {2, EMPLOYEE, "emp1", "emppass", "Bank Employee 1", 30, "Branch A"};
-
-    // 3. Setup Customer A (ID 3)
-    struct User custA = {3, CUSTOMER, "custA", "custApass", "Customer A", 25, "Address A"};
-    struct Account accA = {3, 1000.00, ACTIVE}; // Balance $1000
-
-    // 4. Setup Customer B (ID 4)
-    struct User custB = {4, CUSTOMER, "custB", "custBpass", "Customer B", 50, "Address B"};
-    struct Account accB = {4, 500.00, ACTIVE}; // Balance $500
-
-    // --- Write Users to users.dat ---
-    int fd_u = open(USERS_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-    if (fd_u == -1) { perror("open users.dat"); return 1; }
-    
-    write(fd_u, &admin, sizeof(struct User));
-    write(fd_u, &employee, sizeof(struct User));
-    write(fd_u, &custA, sizeof(struct User));
-    write(fd_u, &custB, sizeof(struct User));
-    close(fd_u);
-
-    // --- Write Accounts to accounts.dat ---
-    int fd_a = open(ACCOUNTS_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-    if (fd_a == -1) { perror("open accounts.dat"); return 1; }
-
-    // Account files must contain records starting from ID 1, even if they are inactive placeholders
-    // We assume ID 1 and 2 are staff accounts without a balance entry in this file
-    // To maintain array-like indexing based on ID, we must pad (or rely on the logic handling missing IDs)
-    // For simplicity, we assume linear records where ID = Index + 1:
-    struct Account padding1 = {1, 0.0, DEACTIVATED}; // Admin
-    struct Account padding2 = {2, 0.0, DEACTIVATED}; // Employee
-
-    write(fd_a, &padding1, sizeof(struct Account));
-    write(fd_a, &padding2, sizeof(struct Account));
-    write(fd_a, &accA, sizeof(struct Account));
-    write(fd_a, &accB, sizeof(struct Account));
-    close(fd_a);
-
-    printf("Successfully created %s and %s for testing.\n", USERS_FILE, ACCOUNTS_FILE);
+#define SEED_USERS 5             // admin, emp1, custA, custB, mgr1
+#define WRITE_CHUNK (4u << 20)   // Bytes each thread buffers per pwrite
+#define HISTORY_DAYS 90          // Generated transactions span this many days up to now
+#define DEFAULT_SKEW 1.0         // Zipf exponent for borrowers and transaction accounts
+#define DEFAULT_HOT_PERMILLE 1   // Hot accounts per 1000 customers
+
+// Files the server derives from the data files; stale copies must not outlive a reset
+static const char *derived_files[] = { "users.idx", "ids.seq", "balances.wal", "txn_heads.idx", "loans.idx", "accrual.ckpt" };
+
+// --- Bulk dataset shape (set once from the command line) ---
+static struct {
+    long long employees;    // In addition to emp1
+    long long customers;    // In addition to custA and custB
+    long long loans;
+    long long transactions;
+    double skew;
+    int hot_permille;
+    uint64_t seed;
+    int threads;
+} cfg = { 0, 0, -1, 0, DEFAULT_SKEW, DEFAULT_HOT_PERMILLE, 42, 1 };
+
+static long long first_employee, first_customer, user_end; // ID layout; user_end is one past the last ID
+static long long rank_base, num_customers;                 // Customers that loans and transactions draw from
+static uint64_t rank_step, rank_step_inverse;              // Rank <-> customer permutation
+static long long history_start_us, history_span_us;
+
+
+// ====================================================================
+// I. DETERMINISTIC RANDOMNESS
+// ====================================================================
+
+// splitmix64: a well-mixed 64-bit value per (stream, record, draw)
+static uint64_t mix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t draw(int stream, uint64_t record, int n) {
+    return mix64(cfg.seed ^ mix64(((uint64_t)stream << 56) ^ (record << 4) ^ (uint64_t)n));
+}
+
+static double draw_unit(int stream, uint64_t record, int n) {
+    return (draw(stream, record, n) >> 11) * (1.0 / 9007199254740992.0); // [0, 1)
+}
+
+static double draw_gauss(int stream, uint64_t record, int n) {
+    double u1 = draw_unit(stream, record, n) + 1e-12;
+    double u2 = draw_unit(stream, record, n + 1);
+    return sqrt(-2.0 * log(u1)) * cos(6.283185307179586 * u2);
+}
+
+// Popularity rank 0 (hottest) .. num_customers-1 under a bounded power law with exponent
+// cfg.skew (continuous inverse CDF; 0 = uniform)
+static long long draw_rank(int stream, uint64_t record, int n) {
+    double u = draw_unit(stream, record, n);
+    double size = (double)num_customers;
+    double x;
+    if (cfg.skew == 0) x = u * size;
+    else if (cfg.skew == 1.0) x = pow(size + 1, u) - 1;
+    else x = pow((pow(size + 1, 1 - cfg.skew) - 1) * u + 1, 1 / (1 - cfg.skew)) - 1;
+    long long rank = (long long)x;
+    return (rank < num_customers) ? rank : num_customers - 1;
+}
+
+static uint64_t mulmod(uint64_t a, uint64_t b, uint64_t m) {
+    return (uint64_t)((unsigned __int128)a * b % m);
+}
+
+// Hot ranks are scattered over the ID space rather than packed at the front
+static long long customer_of_rank(long long rank) {
+    return rank_base + (long long)mulmod(rank, rank_step, num_customers);
+}
+
+static long long rank_of_customer(long long id) {
+    return (long long)mulmod(id - rank_base, rank_step_inverse, num_customers);
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+    while (b) { uint64_t t = a % b; a = b; b = t; }
+    return a;
+}
+
+static uint64_t mod_inverse(uint64_t a, uint64_t m) {
+    long long t = 0, new_t = 1, r = (long long)m, new_r = (long long)a;
+    while (new_r != 0) {
+        long long q = r / new_r, tmp;
+        tmp = t - q * new_t; t = new_t; new_t = tmp;
+        tmp = r - q * new_r; r = new_r; new_r = tmp;
+    }
+    return (uint64_t)((t < 0) ? t + (long long)m : t);
+}
+
+
+// ====================================================================
+// II. RECORD GENERATORS (record n = ID n, stored at index n - 1)
+// ====================================================================
+
+#define STREAM_ACCOUNT 1
+#define STREAM_LOAN 2
+#define STREAM_TXN 3
+#define STREAM_USER 4
+
+static const struct User seed_users[SEED_USERS] = {
+    {1, ADMINISTRATOR, "admin", "adminpass", "Admin User", 40, "HQ"},
+    {2, EMPLOYEE, "emp1", "emppass", "Bank Employee 1", 30, "Branch A"},
+    {3, CUSTOMER, "custA", "custApass", "Customer A", 25, "Address A"},
+    {4, CUSTOMER, "custB", "custBpass", "Customer B", 50, "Address B"},
+    {5, MANAGER, "mgr1", "mgrpass", "Bank Manager 1", 45, "HQ"},
+};
+
+// prefix + decimal n + suffix; sprintf dominates generation time at tens of millions of users
+static void put_name(char *dst, const char *prefix, long long n, const char *suffix) {
+    char digits[24];
+    int len = 0;
+    do { digits[len++] = '0' + n % 10; n /= 10; } while (n > 0);
+    while (*prefix) *dst++ = *prefix++;
+    while (len > 0) *dst++ = digits[--len];
+    while (*suffix) *dst++ = *suffix++;
+    *dst = '\0';
+}
+
+static void make_user(long long id, void *out) {
+    struct User *u = out;
+    if (id <= SEED_USERS) {
+        *u = seed_users[id - 1];
+        return;
+    }
+    memset(u, 0, sizeof(*u));
+    u->id = (int)id;
+    u->age = 18 + (int)(draw(STREAM_USER, id, 0) % 62);
+    if (id < first_customer) {
+        u->role = EMPLOYEE;
+        long long n = id - first_employee + 2; // emp1 is the seed employee
+        sprintf(u->username, "emp%lld", n);
+        sprintf(u->password, "emp%lldpass", n);
+        sprintf(u->name, "Bank Employee %lld", n);
+        sprintf(u->address, "Branch %c", 'A' + (int)(n % 26));
+    } else {
+        u->role = CUSTOMER;
+        put_name(u->username, "cust", id, "");
+        put_name(u->password, "cust", id, "pass");
+        put_name(u->name, "Customer ", id, "");
+        put_name(u->address, "", 1 + (long long)(draw(STREAM_USER, id, 1) % 9999), " Main Street");
+    }
+}
+
+static const struct Account seed_accounts[SEED_USERS] = {
+    {1, 0.0, DEACTIVATED, 0},    // Admin: staff have placeholder records so ID = index + 1
+    {2, 0.0, DEACTIVATED, 0},    // Employee
+    {3, 1000.00, ACTIVE, 0},     // Customer A
+    {4, 500.00, ACTIVE, 0},      // Customer B
+    {5, 0.0, DEACTIVATED, 0},    // Manager
+};
+
+static void make_account(long long id, void *out) {
+    struct Account *a = out;
+    if (id <= SEED_USERS) {
+        *a = seed_accounts[id - 1];
+        return;
+    }
+    a->id = (int)id;
+    a->accrued_through = 0;
+    if (id < first_customer) {
+        a->balance = 0.0;
+        a->status = DEACTIVATED;
+        return;
+    }
+    // Log-normal around ~$2,000, with hot (merchant-like) accounts 1000x larger
+    double balance = 2000.0 * exp(1.2 * draw_gauss(STREAM_ACCOUNT, id, 0));
+    if (rank_of_customer(id) < num_customers * cfg.hot_permille / 1000) balance *= 1000.0;
+    a->balance = (long long)(balance * 100) / 100.0;
+    a->status = (draw(STREAM_ACCOUNT, id, 2) % 100 < 2) ? DEACTIVATED : ACTIVE;
+}
+
+static void make_loan(long long id, void *out) {
+    struct Loan *l = out;
+    int pick = (int)(draw(STREAM_LOAN, id, 0) % 100);
+    l->id = (int)id;
+    l->customer_id = (int)customer_of_rank(draw_rank(STREAM_LOAN, id, 1));
+    l->amount = (long long)(10000.0 * pow(100.0, draw_unit(STREAM_LOAN, id, 2))) / 100 * 100.0; // $10k..$1M
+    l->tenure_months = 12 * (1 + (int)(draw(STREAM_LOAN, id, 3) % 30));
+    // 40% applied, 15% processed, 30% approved, 15% rejected
+    l->status = (pick < 40) ? LOAN_APPLIED : (pick < 55) ? LOAN_PROCESSED : (pick < 85) ? LOAN_APPROVED : LOAN_REJECTED;
+    l->processed_by_id = 0;
+    if (l->status != LOAN_APPLIED) {
+        long long k = (long long)(draw(STREAM_LOAN, id, 4) % (cfg.employees + 1)); // 0 = emp1
+        l->processed_by_id = (k == 0) ? 2 : (int)(first_employee + k - 1);
+    }
+}
+
+// Slots 2k+1 and 2k+2 form one event: a transfer (out + in) or two single-account records.
+// Timestamps rise with the slot, so the server's relinking keeps chains in time order.
+// prev_id and skip_id are left 0: the server relinks the journal when txn_heads.idx is missing.
+static void make_transaction(long long id, void *out) {
+    struct Transaction *t = out;
+    long long event = (id - 1) / 2;
+    int second = (int)((id - 1) % 2);
+    memset(t, 0, sizeof(*t));
+    t->id = (int)id;
+    t->timestamp = history_start_us + (long long)((double)history_span_us * (id - 1) / cfg.transactions);
+    t->amount = (long long)(50.0 * exp(1.0 * draw_gauss(STREAM_TXN, event, 0)) * 100) / 100.0 + 0.01;
+
+    long long from = customer_of_rank(draw_rank(STREAM_TXN, event, 2));
+    if (num_customers > 1 && draw(STREAM_TXN, event, 3) % 100 < 35) {
+        long long to = customer_of_rank(draw_rank(STREAM_TXN, event, 4));
+        if (to == from) to = rank_base + (from - rank_base + 1) % num_customers;
+        t->type = second ? TXN_TRANSFER_IN : TXN_TRANSFER_OUT;
+        t->account_id = (int)(second ? to : from);
+        t->target_account_id = (int)(second ? from : to);
+    } else {
+        if (second) {
+            t->amount = (long long)(50.0 * exp(1.0 * draw_gauss(STREAM_TXN, event, 5)) * 100) / 100.0 + 0.01;
+            from = customer_of_rank(draw_rank(STREAM_TXN, event, 7));
+        }
+        t->type = (draw(STREAM_TXN, event, 8 + second) % 100 < 55) ? TXN_DEPOSIT : TXN_WITHDRAW;
+        t->account_id = (int)from;
+    }
+}
+
+
+// ====================================================================
+// III. PARALLEL RANGE WRITER
+// ====================================================================
+
+struct RangeJob {
+    int fd;
+    size_t record_size;
+    void (*make)(long long id, void *out);
+    long long first_id, end_id; // Records [first_id, end_id) of this file
+    long long base_id;          // ID stored at file offset 0
+    int failed;
+};
+
+static void *write_range(void *arg) {
+    struct RangeJob *job = arg;
+    size_t per_chunk = WRITE_CHUNK / job->record_size;
+    char *buf = malloc(per_chunk * job->record_size);
+    if (buf == NULL) {
+        job->failed = 1;
+        return NULL;
+    }
+
+    for (long long id = job->first_id; id < job->end_id && !job->failed; ) {
+        size_t n = 0;
+        for (; n < per_chunk && id < job->end_id; n++, id++) job->make(id, buf + n * job->record_size);
+        off_t offset = (off_t)(id - n - job->base_id) * job->record_size;
+        size_t len = n * job->record_size, done = 0;
+        while (done < len) {
+            ssize_t w = pwrite(job->fd, buf + done, len - done, offset + done);
+            if (w <= 0) { job->failed = 1; break; }
+            done += w;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+// Writes records [first_id, end_id) to path (truncated and presized), split across threads.
+static int write_file(const char *path, size_t record_size, void (*make)(long long, void *),
+                      long long first_id, long long end_id) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1) { perror(path); return -1; }
+    if (ftruncate(fd, (off_t)(end_id - first_id) * record_size) == -1) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    int threads = cfg.threads;
+    if (end_id - first_id < (long long)threads * 1024) threads = 1; // Not worth splitting
+    struct RangeJob jobs[threads];
+    pthread_t tids[threads];
+    long long per_thread = (end_id - first_id + threads - 1) / threads;
+    for (int i = 0; i < threads; i++) {
+        long long from = first_id + per_thread * i;
+        long long to = (from + per_thread < end_id) ? from + per_thread : end_id;
+        jobs[i] = (struct RangeJob){ fd, record_size, make, from, to, first_id, 0 };
+        if (threads == 1) write_range(&jobs[i]);
+        else pthread_create(&tids[i], NULL, write_range, &jobs[i]);
+    }
+    int failed = 0;
+    for (int i = 0; i < threads; i++) {
+        if (threads > 1) pthread_join(tids[i], NULL);
+        failed |= jobs[i].failed;
+    }
+    close(fd);
+    if (failed) fprintf(stderr, "Write to %s failed.\n", path);
+    return failed ? -1 : 0;
+}
+
+// Journal segments hold JOURNAL_SEGMENT_RECORDS slots each; transaction n is slot n.
+static int write_journal(void) {
+    for (long long first = 1; first <= cfg.transactions; first += JOURNAL_SEGMENT_RECORDS) {
+        char name[64];
+        long long end = first + JOURNAL_SEGMENT_RECORDS;
+        if (end > cfg.transactions + 1) end = cfg.transactions + 1;
+        sprintf(name, JOURNAL_PREFIX ".%06u", (unsigned)((first - 1) / JOURNAL_SEGMENT_RECORDS));
+        if (write_file(name, sizeof(struct Transaction), make_transaction, first, end) == -1) return -1;
+    }
+    return 0;
+}
+
+// One user:pass line per active customer (those that can log in), for loadgen -f
+static int write_credentials(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) { perror(path); return -1; }
+    setvbuf(f, NULL, _IOFBF, WRITE_CHUNK);
+    struct User u;
+    struct Account a;
+    for (long long id = 3; id < user_end; id++) {
+        if (id == first_employee) id = first_customer; // Skip the extra employees
+        if (id >= user_end) break;
+        make_account(id, &a);
+        if (a.status != ACTIVE) continue;
+        make_user(id, &u);
+        fprintf(f, "%s:%s\n", u.username, u.password);
+    }
+    return fclose(f);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-c customers] [-e employees] [-l loans] [-t transactions]\n", prog);
+    fprintf(stderr, "          [-z skew] [-H hot_permille] [-s seed] [-j threads] [-C credentials_file]\n");
+    fprintf(stderr, "  -c N     extra customers (cust<ID> / cust<ID>pass) after custA and custB\n");
+    fprintf(stderr, "  -e N     extra employees (emp2, emp3, ...)\n");
+    fprintf(stderr, "  -l N     loans; rewrites %s (left untouched if not given)\n", LOANS_FILE);
+    fprintf(stderr, "  -t N     transactions in the journal, rounded up to even (default 0)\n");
+    fprintf(stderr, "  -z S     Zipf exponent of borrower/transaction accounts, 0 = uniform (default %.1f)\n", DEFAULT_SKEW);
+    fprintf(stderr, "  -H N     hot accounts per 1000 customers, with 1000x balances (default %d)\n", DEFAULT_HOT_PERMILLE);
+    fprintf(stderr, "  -s N     random seed (default 42)\n");
+    fprintf(stderr, "  -j N     writer threads (default 1)\n");
+    fprintf(stderr, "  -C FILE  also write active customers' credentials, one user:pass per line\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *credentials_file = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:e:l:t:z:H:s:j:C:h")) != -1) {
+        switch (opt) {
+            case 'c': cfg.customers = strtoll(optarg, NULL, 10); break;
+            case 'e': cfg.employees = strtoll(optarg, NULL, 10); break;
+            case 'l': cfg.loans = strtoll(optarg, NULL, 10); break;
+            case 't': cfg.transactions = strtoll(optarg, NULL, 10); break;
+            case 'z': cfg.skew = atof(optarg); break;
+            case 'H': cfg.hot_permille = atoi(optarg); break;
+            case 's': cfg.seed = strtoull(optarg, NULL, 10); break;
+            case 'j': cfg.threads = atoi(optarg); break;
+            case 'C': credentials_file = optarg; break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+    // IDs are ints on disk and in the protocol
+    if (cfg.customers < 0 || cfg.employees < 0 || cfg.loans < -1 || cfg.transactions < 0 ||
+        cfg.skew < 0 || cfg.hot_permille < 0 || cfg.hot_permille > 1000 || cfg.threads < 1 ||
+        cfg.customers + cfg.employees + SEED_USERS > 0x7fffffff || cfg.loans > 0x7ffffffe ||
+        cfg.transactions > 0x7ffffffe) {
+        usage(argv[0]);
+        return 1;
+    }
+    cfg.transactions += cfg.transactions % 2;
+
+    // --- ID layout: admin, emp1, custA, custB, mgr1, extra employees, extra customers ---
+    first_employee = SEED_USERS + 1;
+    first_customer = first_employee + cfg.employees;
+    user_end = first_customer + cfg.customers;
+    // Loans and transactions go to the extra customers when there are any, else custA/custB
+    rank_base = (cfg.customers > 0) ? first_customer : 3;
+    num_customers = (cfg.customers > 0) ? cfg.customers : 2;
+    rank_step = 2654435761u % num_customers;
+    while (rank_step == 0 || gcd(rank_step, num_customers) != 1) rank_step++;
+    rank_step_inverse = mod_inverse(rank_step, num_customers);
+    history_span_us = (long long)HISTORY_DAYS * 24 * 3600 * 1000000;
+    history_start_us = (long long)time(NULL) * 1000000 - history_span_us;
+
+    // --- Users and accounts (ID = index + 1) ---
+    if (write_file(USERS_FILE, sizeof(struct User), make_user, 1, user_end) == -1) return 1;
+    if (write_file(ACCOUNTS_FILE, sizeof(struct Account), make_account, 1, user_end) == -1) return 1;
+    if (cfg.loans >= 0 && write_file(LOANS_FILE, sizeof(struct Loan), make_loan, 1, cfg.loans + 1) == -1) return 1;
+
+    for (size_t i = 0; i < sizeof(derived_files) / sizeof(derived_files[0]); i++) {
+        unlink(derived_files[i]);
+    }
+    // Transaction journal segments (transactions.000000, transactions.000001, ...)
+    DIR *dir = opendir(".");
+    if (dir != NULL) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strncmp(entry->d_name, "transactions.", 13) == 0) unlink(entry->d_name);
+        }
+        closedir(dir);
+    }
+    if (cfg.transactions > 0 && write_journal() == -1) return 1;
+    if (credentials_file != NULL && write_credentials(credentials_file) == -1) return 1;
+
+    if (user_end == SEED_USERS + 1 && cfg.loans < 0 && cfg.transactions == 0) {
+        printf("Successfully created %s and %s for testing.\n", USERS_FILE, ACCOUNTS_FILE);
+    } else {
+        printf("Successfully created %lld users (%lld customers), %lld loans and %lld transactions.\n",
+               user_end - 1, cfg.customers + 2, cfg.loans > 0 ? cfg.loans : 0,
+               cfg.transactions);
+    }
     return 0;
-}
\ No newline at end of file
+}
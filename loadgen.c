@@ -0,0 +1,743 @@
+// loadgen.c
+//
+// Load generator for the bank server. Opens many concurrent sessions, logs each one in
+// as a customer and drives a weighted mix of commands over the struct Message protocol,
+// then reports throughput and latency percentiles per command.
+//
+// Build: gcc -O2 -o loadgen loadgen.c utils.c -lpthread
+//
+// Closed loop (default): every session sends its next request as soon as the reply to
+// the previous one arrives. Open loop (-r): requests are scheduled at a constant total
+// rate whether or not the server keeps up. Each request's latency is measured from its
+// scheduled send time, so a stalled server is charged for the whole queueing delay
+// (no coordinated omission) and the saturation point shows up as a latency cliff.
+// Pipelining (-P): each session keeps up to DEPTH requests in flight, matching replies
+// to requests by the echoed request_id. -C negotiates the compact wire protocol; the
+// report shows the bytes each request and reply took on the wire either way.
+// -U connects over the server's AF_UNIX socket instead of TCP, and -R then moves every
+// session onto a shared-memory ring, which the workers busy-poll between sleeps.
+
+#define _GNU_SOURCE      // For epoll_pwait2
+#include <sys/socket.h>
+#include <sys/un.h>      // For sockaddr_un (-U)
+#include <netinet/in.h>
+#include <netinet/tcp.h> // For TCP_NODELAY
+#include <arpa/inet.h>
+#include <sys/epoll.h>   // For epoll_create1, epoll_ctl, epoll_pwait2
+#include <errno.h>
+#include <fcntl.h>       // For fcntl, O_NONBLOCK
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>        // For clock_gettime
+#include <unistd.h>      // For getopt
+
+#include "utils.h"
+#include "structs.h"
+
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_PORT 8080
+#define DEFAULT_SESSIONS 64
+#define DEFAULT_THREADS 4
+#define DEFAULT_DURATION 10       // Seconds of measurement
+#define DEFAULT_AMOUNT 1.00       // Deposit/withdraw/transfer amount
+#define MAX_CREDENTIALS 100000
+#define MAX_EVENTS 256
+#define PENDING_MAX 1000000       // Open-loop requests waiting for a free session, per thread
+#define MAX_DEPTH 64              // Pipelined requests in flight per session
+#define RING_SPIN_PASSES 1000     // Empty polls of every ring before a worker sleeps (-R)
+
+// Latency histogram: log-linear buckets (HDR style). Values below 2^HIST_SUB_BITS ns are
+// exact; above that every power of two is split into 2^HIST_SUB_BITS buckets, so any
+// recorded value is within 1/64 (~1.6%) of the truth, up to ~2^40 ns (18 minutes).
+#define HIST_SUB_BITS 6
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAGNITUDES 35
+#define HIST_BUCKETS (HIST_SUB * (HIST_MAGNITUDES + 1))
+
+// Commands the generator can drive (index into the mix)
+#define OP_BALANCE 0
+#define OP_DEPOSIT 1
+#define OP_WITHDRAW 2
+#define OP_TRANSFER 3
+#define OP_LOAN_APPLY 4
+#define OP_LOAN_STATUS 5
+#define OP_COUNT 6
+
+static const struct {
+    const char *name;
+    int command;
+} ops[OP_COUNT] = {
+    { "balance", CMD_VIEW_BALANCE },
+    { "deposit", CMD_DEPOSIT },
+    { "withdraw", CMD_WITHDRAW },
+    { "transfer", CMD_TRANSFER },
+    { "loan_apply", CMD_APPLY_LOAN },
+    { "loan_status", CMD_VIEW_LOAN_STATUS },
+};
+
+struct Histogram {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t errors;  // Replies with success_status == 0
+    uint64_t max_ns;
+    double sum_ns;
+};
+
+struct Credential {
+    char username[MAX_NAME_LEN];
+    char password[MAX_PASS_LEN];
+};
+
+struct Pending {
+    uint64_t intended_ns;
+    int op;
+};
+
+// One client session: a logged-in socket with up to `depth` requests in flight
+struct LoadSession {
+    int sd;
+    struct RingEnd *ring;      // -R: requests and replies go here instead of sd
+    int asleep;                // Announced to the server that it sleeps on the ring
+    int account_id;
+    int protocol;              // WIRE_FIXED or WIRE_COMPACT
+    int busy;                  // Requests in flight
+    struct Pending sent[MAX_DEPTH]; // FIFO of requests in flight, oldest at sent_head
+    unsigned int request_ids[MAX_DEPTH];
+    int sent_head;
+    unsigned int next_id;
+    char in_buf[MAX_DEPTH * sizeof(struct Message)];
+    size_t in_len;
+};
+
+struct Worker {
+    pthread_t thread;
+    int index;
+    struct LoadSession *sessions;
+    int nsessions;
+    int *idle;                 // Stack of free request slots (a session appears once per slot)
+    int nidle;
+    struct Pending *pending;   // Open-loop FIFO of requests waiting for an idle session
+    size_t pending_head;
+    size_t pending_len;
+    unsigned int seed;
+    uint64_t dropped;          // Open-loop requests the pending FIFO had no room for
+    uint64_t sent, bytes_sent; // Requests written and their size on the wire
+    uint64_t received, bytes_received;
+    struct Histogram hist[OP_COUNT];
+    int failed;
+};
+
+// --- Run configuration (set once from the command line) ---
+static const char *host = DEFAULT_HOST;
+static int port = DEFAULT_PORT;
+static int num_sessions = DEFAULT_SESSIONS;
+static int depth = 1;           // Requests in flight per session
+static int compact = 0;         // Negotiate the compact wire protocol
+static const char *unix_path = NULL; // -U: the server's local socket
+static int use_ring = 0;        // -R: shared-memory rings over the local socket
+static int num_threads = DEFAULT_THREADS;
+static int duration_sec = DEFAULT_DURATION;
+static int warmup_sec = 0;
+static double total_rate = 0;   // Requests per second across all threads, 0 = closed loop
+static double amount = DEFAULT_AMOUNT;
+static int mix[OP_COUNT] = { 40, 20, 20, 20, 0, 0 };
+static int mix_total = 100;
+static struct Credential *credentials = NULL;
+static int num_credentials = 0;
+
+// Account IDs of every logged-in session, for picking transfer targets
+static int *account_ids = NULL;
+static int num_accounts = 0;
+static pthread_mutex_t accounts_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t start_barrier;
+static uint64_t start_ns, measure_ns, end_ns;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+// ====================================================================
+// I. LATENCY HISTOGRAMS
+// ====================================================================
+
+static int hist_bucket(uint64_t v) {
+    if (v < HIST_SUB) return (int)v;
+    int magnitude = 63 - __builtin_clzll(v) - HIST_SUB_BITS + 1; // >= 1
+    if (magnitude > HIST_MAGNITUDES) return HIST_BUCKETS - 1;
+    return magnitude * HIST_SUB + (int)((v >> (magnitude - 1)) & (HIST_SUB - 1));
+}
+
+// Upper bound of the values a bucket holds
+static uint64_t hist_bucket_value(int bucket) {
+    int magnitude = bucket / HIST_SUB;
+    uint64_t sub = bucket % HIST_SUB;
+    if (magnitude == 0) return sub;
+    return ((HIST_SUB | sub) << (magnitude - 1)) + ((1ULL << (magnitude - 1)) - 1);
+}
+
+static void hist_record(struct Histogram *h, uint64_t ns, int ok) {
+    h->counts[hist_bucket(ns)]++;
+    h->total++;
+    h->sum_ns += ns;
+    if (ns > h->max_ns) h->max_ns = ns;
+    if (!ok) h->errors++;
+}
+
+static void hist_merge(struct Histogram *into, const struct Histogram *from) {
+    for (int i = 0; i < HIST_BUCKETS; i++) into->counts[i] += from->counts[i];
+    into->total += from->total;
+    into->errors += from->errors;
+    into->sum_ns += from->sum_ns;
+    if (from->max_ns > into->max_ns) into->max_ns = from->max_ns;
+}
+
+static uint64_t hist_percentile(const struct Histogram *h, double pct) {
+    if (h->total == 0) return 0;
+    uint64_t rank = (uint64_t)(pct / 100.0 * h->total + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t v = hist_bucket_value(i);
+            return (v < h->max_ns) ? v : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+
+// ====================================================================
+// II. SESSIONS
+// ====================================================================
+
+static int session_connect(struct LoadSession *s) {
+    if (unix_path != NULL) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, unix_path, sizeof(addr.sun_path) - 1);
+        s->sd = sys_socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s->sd < 0) return -1;
+        if (sys_connect(s->sd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            sys_close(s->sd);
+            return -1;
+        }
+        return 0;
+    }
+
+    struct sockaddr_in addr;
+    int one = 1;
+    s->sd = sys_socket(AF_INET, SOCK_STREAM, 0);
+    if (s->sd < 0) return -1;
+    setsockopt(s->sd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) <= 0 ||
+        sys_connect(s->sd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        sys_close(s->sd);
+        return -1;
+    }
+    return 0;
+}
+
+// Connects and logs in synchronously; the session is switched to non-blocking after.
+static int session_open(struct LoadSession *s, const struct Credential *cred) {
+    struct Message request, response;
+
+    if (session_connect(s) == -1) return -1;
+
+    struct Pipeline pipeline;
+    pipeline_init(&pipeline, s->sd);
+    memset(&request, 0, sizeof(request));
+    request.command = CMD_LOGIN;
+    request.source_id = CUSTOMER;
+    strncpy(request.data, cred->username, MAX_NAME_LEN);
+    strncpy(request.data + MAX_NAME_LEN, cred->password, MAX_PASS_LEN);
+    if ((compact && pipeline_negotiate(&pipeline) != WIRE_COMPACT) ||
+        (use_ring && pipeline_attach_ring(&pipeline) == -1) ||
+        pipeline_queue(&pipeline, &request) == 0 || pipeline_flush(&pipeline) == -1 ||
+        pipeline_reply(&pipeline, &response, NULL, 0) == -1 || !response.success_status) {
+        pipeline_free(&pipeline);
+        sys_close(s->sd);
+        return -1;
+    }
+    s->account_id = response.source_id;
+    s->protocol = pipeline.protocol;
+    s->ring = pipeline.ring;
+    pipeline.ring = NULL; // Keep it past pipeline_free()
+    pipeline_free(&pipeline);
+
+    int flags = fcntl(s->sd, F_GETFL, 0);
+    fcntl(s->sd, F_SETFL, flags | O_NONBLOCK);
+    return 0;
+}
+
+static int pick_op(struct Worker *w) {
+    int r = rand_r(&w->seed) % mix_total;
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (r < mix[op]) return op;
+        r -= mix[op];
+    }
+    return OP_BALANCE;
+}
+
+static int session_send(struct Worker *w, struct LoadSession *s, int op, uint64_t intended_ns) {
+    struct Message request;
+
+    memset(&request, 0, sizeof(request));
+    request.command = ops[op].command;
+    request.source_id = s->account_id;
+    switch (op) {
+        case OP_DEPOSIT:
+        case OP_WITHDRAW:
+            request.amount = amount;
+            break;
+        case OP_TRANSFER:
+            request.amount = amount;
+            do {
+                request.target_id = account_ids[rand_r(&w->seed) % num_accounts];
+            } while (request.target_id == s->account_id);
+            break;
+        case OP_LOAN_APPLY:
+            request.amount = 1000.0 * (1 + rand_r(&w->seed) % 100);
+            request.target_id = 12 * (1 + rand_r(&w->seed) % 10); // Tenure in months
+            break;
+    }
+
+    if (++s->next_id == 0) s->next_id = 1;
+    request.request_id = s->next_id;
+
+    unsigned char frame[WIRE_HEADER_MAX];
+    const void *out = &request;
+    size_t len = sizeof(request);
+    if (s->protocol == WIRE_COMPACT) {
+        len = wire_encode(&request, 0, 0, frame);
+        out = frame;
+    }
+    // At most MAX_DEPTH messages are unanswered, far below the socket buffer (or ring),
+    // so a send is never partial
+    ssize_t n = s->ring ? ring_write(s->ring, out, len) : sys_write(s->sd, out, len);
+    if (n != (ssize_t)len) return -1;
+    w->sent++;
+    w->bytes_sent += len;
+    int slot = (s->sent_head + s->busy) % MAX_DEPTH;
+    s->sent[slot] = (struct Pending){ intended_ns, op };
+    s->request_ids[slot] = request.request_id;
+    s->busy++;
+    return 0;
+}
+
+// Hands a free request slot the oldest waiting request, or a fresh one in closed loop.
+static void session_next(struct Worker *w, int idx, uint64_t now) {
+    struct LoadSession *s = &w->sessions[idx];
+    if (total_rate > 0) {
+        if (w->pending_len == 0) {
+            w->idle[w->nidle++] = idx;
+            return;
+        }
+        struct Pending p = w->pending[w->pending_head];
+        w->pending_head = (w->pending_head + 1) % PENDING_MAX;
+        w->pending_len--;
+        if (session_send(w, s, p.op, p.intended_ns) == -1) w->failed++;
+    } else if (now < end_ns) {
+        if (session_send(w, s, pick_op(w), now) == -1) w->failed++;
+    }
+}
+
+
+static void session_close(struct LoadSession *s) {
+    if (s->sd < 0) return;
+    ring_detach(s->ring); // Its eventfd leaves the epoll set with it
+    s->ring = NULL;
+    sys_close(s->sd);
+    s->sd = -1;
+    s->busy = 0;
+}
+
+// Reads what has arrived for a session and matches its complete replies to the
+// requests in flight. Returns the bytes read, 0 if nothing was waiting, or -1 if the
+// session was lost.
+static ssize_t session_receive(struct Worker *w, int idx, uint64_t now) {
+    struct LoadSession *s = &w->sessions[idx];
+    if (s->sd < 0) return 0;
+    ssize_t got = s->ring ? ring_read(s->ring, s->in_buf + s->in_len, sizeof(s->in_buf) - s->in_len)
+                          : sys_read(s->sd, s->in_buf + s->in_len, sizeof(s->in_buf) - s->in_len);
+    if (got == 0 && s->ring) return 0;
+    if (got <= 0) {
+        if (got == -1 && errno == EAGAIN) return 0;
+        session_close(s);
+        w->failed++;
+        return -1;
+    }
+    s->in_len += got;
+
+    // Replies come back in request order; each one frees a slot for the next send
+    size_t used = 0;
+    while (s->busy > 0) {
+        struct Message response;
+        size_t records_len;
+        ssize_t size = 0;
+        if (s->protocol == WIRE_COMPACT) {
+            size = wire_decode(s->in_buf + used, s->in_len - used, 1, &response, &records_len);
+        } else if (s->in_len - used >= sizeof(struct Message)) {
+            memcpy(&response, s->in_buf + used, sizeof(response));
+            size = sizeof(response) + reply_records_size(&response);
+            if ((size_t)size > s->in_len - used) size = 0;
+        }
+        if (size <= 0) break; // Incomplete (replies in the mix never exceed in_buf)
+        used += size;
+        w->received++;
+        w->bytes_received += size;
+        struct Pending sent = s->sent[s->sent_head];
+        int matched = (response.request_id == s->request_ids[s->sent_head]);
+        s->sent_head = (s->sent_head + 1) % MAX_DEPTH;
+        s->busy--;
+        if (!matched) w->failed++;
+        if (sent.intended_ns >= measure_ns) {
+            hist_record(&w->hist[sent.op], now - sent.intended_ns,
+                        matched && response.success_status);
+        }
+        session_next(w, idx, now);
+    }
+    memmove(s->in_buf, s->in_buf + used, s->in_len - used);
+    s->in_len -= used;
+    return got;
+}
+
+// Before a worker sleeps on its rings' eventfds: asks each server to wake it. Returns 0
+// if a reply slipped in meanwhile, so the worker must not block.
+static int rings_idle(struct Worker *w) {
+    int may_sleep = 1;
+    for (int i = 0; i < w->nsessions; i++) {
+        struct LoadSession *s = &w->sessions[i];
+        if (s->ring == NULL || s->busy == 0 || s->asleep) continue;
+        if (ring_idle(s->ring, 1, 0)) s->asleep = 1;
+        else may_sleep = 0;
+    }
+    return may_sleep;
+}
+
+static void rings_resume(struct Worker *w) {
+    for (int i = 0; i < w->nsessions; i++) {
+        struct LoadSession *s = &w->sessions[i];
+        if (!s->asleep) continue;
+        if (s->ring != NULL) ring_resume(s->ring);
+        s->asleep = 0;
+    }
+}
+
+
+// ====================================================================
+// III. WORKER THREADS
+// ====================================================================
+
+static void *worker_main(void *arg) {
+    struct Worker *w = arg;
+    struct epoll_event ev, events[MAX_EVENTS];
+    int epfd = epoll_create1(0);
+    int quiet_passes = 0; // -R: consecutive polls of every ring that found nothing
+    int spin_passes = ring_spin_limit(RING_SPIN_PASSES);
+
+    for (int i = 0; i < w->nsessions; i++) {
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, w->sessions[i].ring ? w->sessions[i].ring->wait_fd : w->sessions[i].sd, &ev);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+
+    // Open loop: this thread's share of the rate, as a fixed schedule of send times
+    double interval_ns = (total_rate > 0) ? 1e9 * num_threads / total_rate : 0;
+    uint64_t scheduled = 0;
+    uint64_t now = now_ns();
+
+    for (int d = 0; d < depth; d++) {
+        if (total_rate > 0) {
+            for (int i = w->nsessions - 1; i >= 0; i--) w->idle[w->nidle++] = i;
+        } else {
+            for (int i = 0; i < w->nsessions; i++) session_next(w, i, now);
+        }
+    }
+
+    int in_flight = 1;
+    while (now < end_ns || in_flight) {
+        if (total_rate > 0 && now < end_ns) {
+            uint64_t due = start_ns + (uint64_t)(scheduled * interval_ns);
+            while (due <= now && due < end_ns) {
+                int op = pick_op(w);
+                if (w->nidle > 0) {
+                    if (session_send(w, &w->sessions[w->idle[--w->nidle]], op, due) == -1) w->failed++;
+                } else if (w->pending_len < PENDING_MAX) {
+                    w->pending[(w->pending_head + w->pending_len) % PENDING_MAX] = (struct Pending){ due, op };
+                    w->pending_len++;
+                } else {
+                    w->dropped++;
+                }
+                scheduled++;
+                due = start_ns + (uint64_t)(scheduled * interval_ns);
+            }
+        }
+
+        // Sleep until the next scheduled send with nanosecond resolution; a millisecond
+        // timeout would either bunch sends up or spin on a core the server needs
+        uint64_t wait_ns = 100000000;
+        if (total_rate > 0 && now < end_ns) {
+            uint64_t due = start_ns + (uint64_t)(scheduled * interval_ns);
+            wait_ns = (due > now) ? due - now : 0;
+        }
+        struct timespec timeout = { wait_ns / 1000000000, wait_ns % 1000000000 };
+        int n = 0;
+        if (!use_ring || quiet_passes >= spin_passes) { // Rings are polled without sleeping for a while
+            if (use_ring && !rings_idle(w)) timeout.tv_sec = timeout.tv_nsec = 0;
+            n = epoll_pwait2(epfd, events, MAX_EVENTS, &timeout, NULL);
+            if (use_ring) rings_resume(w);
+        }
+        now = now_ns();
+
+        if (use_ring) {
+            int progress = 0;
+            for (int i = 0; i < w->nsessions; i++) {
+                if (session_receive(w, i, now) > 0) progress = 1;
+            }
+            quiet_passes = progress ? 0 : quiet_passes + 1;
+        } else {
+            for (int i = 0; i < n; i++) session_receive(w, events[i].data.u32, now);
+        }
+
+        in_flight = 0;
+        for (int i = 0; i < w->nsessions && !in_flight; i++) in_flight = w->sessions[i].busy;
+        if (now >= end_ns + 5000000000ULL) break; // Give up on replies that never come
+    }
+
+    for (int i = 0; i < w->nsessions; i++) session_close(&w->sessions[i]);
+    sys_close(epfd);
+    return NULL;
+}
+
+
+// ====================================================================
+// IV. CONFIGURATION AND REPORT
+// ====================================================================
+
+static int add_credential(const char *spec) {
+    const char *colon = strchr(spec, ':');
+    if (colon == NULL || num_credentials >= MAX_CREDENTIALS) return -1;
+    struct Credential *c = &credentials[num_credentials++];
+    memset(c, 0, sizeof(*c));
+    snprintf(c->username, sizeof(c->username), "%.*s", (int)(colon - spec), spec);
+    snprintf(c->password, sizeof(c->password), "%s", colon + 1);
+    return 0;
+}
+
+// USER:PASS[,USER:PASS...]
+static int parse_credential_list(char *list) {
+    for (char *tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (add_credential(tok) == -1) return -1;
+    }
+    return 0;
+}
+
+// One USER:PASS per line
+static int load_credential_file(const char *path) {
+    FILE *f = fopen(path, "r");
+    char line[128];
+    if (f == NULL) return -1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0' && add_credential(line) == -1) {
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+// NAME=WEIGHT[,NAME=WEIGHT...]; commands not named get weight 0
+static int parse_mix(char *spec) {
+    memset(mix, 0, sizeof(mix));
+    mix_total = 0;
+    for (char *tok = strtok(spec, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        char *eq = strchr(tok, '=');
+        if (eq == NULL) return -1;
+        *eq = '\0';
+        int op;
+        for (op = 0; op < OP_COUNT && strcmp(ops[op].name, tok) != 0; op++);
+        if (op == OP_COUNT || atoi(eq + 1) < 0) return -1;
+        mix[op] = atoi(eq + 1);
+        mix_total += mix[op];
+    }
+    return (mix_total > 0) ? 0 : -1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-H host] [-p port] [-s sessions] [-t threads] [-d sec] [-w sec] [-r rate]\n", prog);
+    fprintf(stderr, "          [-P depth] [-C] [-U path [-R]] [-m mix] [-a amount] [-u user:pass,...] [-f credentials_file]\n");
+    fprintf(stderr, "  -s N     concurrent sessions, spread over the credentials (default %d)\n", DEFAULT_SESSIONS);
+    fprintf(stderr, "  -P N     pipelined requests in flight per session, 1..%d (default 1)\n", MAX_DEPTH);
+    fprintf(stderr, "  -C       use the compact wire protocol (default: fixed struct Message)\n");
+    fprintf(stderr, "  -U PATH  connect to the server's local socket (server -u) instead of -H/-p\n");
+    fprintf(stderr, "  -R       with -U: move each session onto a shared-memory ring\n");
+    fprintf(stderr, "  -t N     worker threads (default %d)\n", DEFAULT_THREADS);
+    fprintf(stderr, "  -d SEC   measured duration (default %d)\n", DEFAULT_DURATION);
+    fprintf(stderr, "  -w SEC   warm-up before measuring (default 0)\n");
+    fprintf(stderr, "  -r RATE  open loop at RATE requests/s in total (default: closed loop)\n");
+    fprintf(stderr, "  -m MIX   command weights, e.g. balance=40,deposit=20,withdraw=20,transfer=20\n");
+    fprintf(stderr, "           (commands: balance deposit withdraw transfer loan_apply loan_status)\n");
+    fprintf(stderr, "  -a AMT   amount per deposit/withdraw/transfer (default %.2f)\n", DEFAULT_AMOUNT);
+    fprintf(stderr, "  -u LIST  customer credentials (default custA:custApass,custB:custBpass)\n");
+    fprintf(stderr, "  -f FILE  customer credentials, one user:pass per line\n");
+}
+
+static void print_report(struct Worker *workers) {
+    struct Histogram *all = calloc(OP_COUNT + 1, sizeof(struct Histogram));
+    uint64_t dropped = 0, sent = 0, bytes_sent = 0, received = 0, bytes_received = 0;
+    int failed = 0;
+    char line[256];
+
+    for (int t = 0; t < num_threads; t++) {
+        for (int op = 0; op < OP_COUNT; op++) {
+            hist_merge(&all[op], &workers[t].hist[op]);
+            hist_merge(&all[OP_COUNT], &workers[t].hist[op]);
+        }
+        dropped += workers[t].dropped;
+        failed += workers[t].failed;
+        sent += workers[t].sent;
+        bytes_sent += workers[t].bytes_sent;
+        received += workers[t].received;
+        bytes_received += workers[t].bytes_received;
+    }
+
+    double secs = duration_sec;
+    sprintf(line, "\n%-12s %10s %8s %10s %10s %10s %10s %10s %10s\n",
+            "command", "ops", "errors", "ops/s", "mean(us)", "p50(us)", "p99(us)", "p99.9(us)", "max(us)");
+    sys_write_string(line);
+    for (int op = 0; op <= OP_COUNT; op++) {
+        struct Histogram *h = &all[op];
+        if (h->total == 0 && op < OP_COUNT) continue;
+        sprintf(line, "%-12s %10llu %8llu %10.0f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                (op < OP_COUNT) ? ops[op].name : "total",
+                (unsigned long long)h->total, (unsigned long long)h->errors, h->total / secs,
+                h->total ? h->sum_ns / h->total / 1000.0 : 0.0,
+                hist_percentile(h, 50.0) / 1000.0, hist_percentile(h, 99.0) / 1000.0,
+                hist_percentile(h, 99.9) / 1000.0, h->max_ns / 1000.0);
+        sys_write_string(line);
+    }
+    sprintf(line, "\nWire (%s): %.1f bytes per request, %.1f bytes per reply\n", compact ? "compact" : "fixed",
+            sent ? (double)bytes_sent / sent : 0.0, received ? (double)bytes_received / received : 0.0);
+    sys_write_string(line);
+    if (total_rate > 0) {
+        sprintf(line, "Open loop: target %.0f req/s, achieved %.0f req/s measured; %llu requests dropped (backlog full)\n",
+                total_rate, all[OP_COUNT].total / secs, (unsigned long long)dropped);
+        sys_write_string(line);
+    }
+    if (failed > 0) {
+        sprintf(line, "%d send/receive failures (connections lost)\n", failed);
+        sys_write_string(line);
+    }
+    free(all);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+
+    credentials = calloc(MAX_CREDENTIALS, sizeof(struct Credential));
+    while ((opt = getopt(argc, argv, "H:p:s:t:d:w:r:P:CU:Rm:a:u:f:h")) != -1) {
+        switch (opt) {
+            case 'H': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 's': num_sessions = atoi(optarg); break;
+            case 't': num_threads = atoi(optarg); break;
+            case 'd': duration_sec = atoi(optarg); break;
+            case 'w': warmup_sec = atoi(optarg); break;
+            case 'r': total_rate = atof(optarg); break;
+            case 'P': depth = atoi(optarg); break;
+            case 'C': compact = 1; break;
+            case 'U': unix_path = optarg; break;
+            case 'R': use_ring = 1; break;
+            case 'a': amount = atof(optarg); break;
+            case 'm':
+                if (parse_mix(optarg) == -1) { usage(argv[0]); exit(EXIT_FAILURE); }
+                break;
+            case 'u':
+                if (parse_credential_list(optarg) == -1) { usage(argv[0]); exit(EXIT_FAILURE); }
+                break;
+            case 'f':
+                if (load_credential_file(optarg) == -1) {
+                    perror("[LOADGEN] Credentials file");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                usage(argv[0]);
+                exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (num_sessions < 1 || num_threads < 1 || duration_sec < 1 || warmup_sec < 0 || total_rate < 0 ||
+        depth < 1 || depth > MAX_DEPTH || (use_ring && unix_path == NULL)) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (num_threads > num_sessions) num_threads = num_sessions;
+    if (num_credentials == 0) {
+        add_credential("custA:custApass");
+        add_credential("custB:custBpass");
+    }
+
+    // --- Log every session in before the clock starts ---
+    struct Worker *workers = calloc(num_threads, sizeof(struct Worker));
+    account_ids = calloc(num_sessions, sizeof(int));
+    int opened = 0;
+    for (int t = 0; t < num_threads; t++) {
+        struct Worker *w = &workers[t];
+        w->index = t;
+        w->seed = (unsigned int)(now_ns() ^ (t * 2654435761u));
+        w->nsessions = num_sessions / num_threads + (t < num_sessions % num_threads);
+        w->sessions = calloc(w->nsessions, sizeof(struct LoadSession));
+        w->idle = calloc((size_t)w->nsessions * depth, sizeof(int));
+        if (total_rate > 0) w->pending = calloc(PENDING_MAX, sizeof(struct Pending));
+        for (int i = 0; i < w->nsessions; i++, opened++) {
+            if (session_open(&w->sessions[i], &credentials[opened % num_credentials]) == -1) {
+                fprintf(stderr, "[LOADGEN] Session %d (%s) failed to connect or log in\n",
+                        opened, credentials[opened % num_credentials].username);
+                exit(EXIT_FAILURE);
+            }
+            pthread_mutex_lock(&accounts_mutex);
+            int known = 0;
+            for (int a = 0; a < num_accounts && !known; a++) known = (account_ids[a] == w->sessions[i].account_id);
+            if (!known) account_ids[num_accounts++] = w->sessions[i].account_id;
+            pthread_mutex_unlock(&accounts_mutex);
+        }
+    }
+    if (mix[OP_TRANSFER] > 0 && num_accounts < 2) {
+        fprintf(stderr, "[LOADGEN] Transfers need at least two distinct customer accounts\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("[LOADGEN] %d sessions (%d accounts) on %d threads over %s, %s, depth %d, %d s warm-up + %d s measured\n",
+           num_sessions, num_accounts, num_threads, use_ring ? "rings" : (unix_path ? "a local socket" : "TCP"),
+           (total_rate > 0) ? "open loop" : "closed loop", depth, warmup_sec, duration_sec);
+    fflush(stdout);
+
+    pthread_barrier_init(&start_barrier, NULL, num_threads + 1);
+    for (int t = 0; t < num_threads; t++) {
+        pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]);
+    }
+    start_ns = now_ns();
+    measure_ns = start_ns + (uint64_t)warmup_sec * 1000000000ULL;
+    end_ns = measure_ns + (uint64_t)duration_sec * 1000000000ULL;
+    pthread_barrier_wait(&start_barrier);
+
+    for (int t = 0; t < num_threads; t++) pthread_join(workers[t].thread, NULL);
+    print_report(workers);
+    return 0;
+}
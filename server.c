@@ -1,14 +1,20 @@
 // server.c
 
 #include <sys/socket.h> // For socket, bind, listen, accept
+#include <sys/un.h>     // For sockaddr_un (local listener)
 #include <netinet/in.h> // For sockaddr_in, INADDR_ANY, htons
+#include <poll.h>       // For poll (fork mode with two listeners)
 #include <arpa/inet.h>  // For inet_ntoa
 #include <errno.h>      // For errno, EINTR
 #include <signal.h>     // Defines struct sigaction, sigaction()
 #include <sys/wait.h>   // Defines waitpid()
+#include <sys/epoll.h>  // For epoll_create1, epoll_ctl, epoll_wait (event mode)
+#include <fcntl.h>      // For fcntl, O_NONBLOCK
 #include <stdlib.h>     // For exit, EXIT_FAILURE
 #include <stdio.h>      // For printf, perror
-#include <unistd.h>     // For fork, close, sys_close
+#include <string.h>     // For strcmp, memcpy, memmove
+#include <unistd.h>     // For fork, close, sys_close, getopt
+#include <sys/prctl.h>  // For PR_SET_PDEATHSIG (loan auditor)
 
 #include "utils.h"
 #include "structs.h"
@@ -16,217 +22,1345 @@
 #define PORT 8080
 #define BACKLOG 10 // Max pending connections
 
-// CRITICAL FIX: The definition of current_user is moved to utils.c.
-// We keep the definition specific to this file to hold the session state in the CHILD process.
-// NOTE: If your g++ continues to complain about multiple definition, you must change this line to:
-// extern struct User current_user; // And remove the current_user definition in utils.c as well.
-extern struct User current_user;
+// Event mode tuning
+#define EVENT_BACKLOG 1024   // Listen backlog when one process serves every connection
+#define MAX_EVENTS 256       // epoll_wait batch size
+#define OUT_BUF_INIT 4096    // Initial per-connection output buffer
+#define IN_BUF_MESSAGES 16   // Pipelined requests read from a connection at once
+#define OUT_BUF_HIGH_WATER (1 << 20) // Stop reading a client whose replies pile up past this
+#define BUSY_EPOLL_EVERY 64  // While rings have work, check the sockets only every Nth loop
 
-// Function declarations for functions defined in utils.c
-extern int authenticate_and_set_user(char *username, char *password, int expected_role);
-extern void serve_view_balance(int client_sd, struct Message *request);
-extern void serve_deposit(int client_sd, struct Message *request);
-extern void serve_withdraw(int client_sd, struct Message *request);
-extern void serve_transfer(int client_sd, struct Message *request); 
+// Server concurrency models (selected with -m at startup)
+#define MODE_FORK 1  // One child process per connection (original model)
+#define MODE_EVENT 2 // One process, non-blocking sockets, epoll event loop
+#define MODE_PREFORK 3 // N long-lived workers, each an event loop on its own SO_REUSEPORT listener
+
+// Pre-forked pool defaults (override with -n and -c)
+#define DEFAULT_POOL_SIZE 4        // Workers kept alive by the master
+#define DEFAULT_MAX_CONNS 10000    // Connections a worker accepts before it retires (0 = never)
+#define RESPAWN_BACKOFF_SEC 1      // Delay before replacing a worker that died during startup
+#define DEFAULT_SESSION_TTL 1800   // Seconds an unused session token stays resumable
+#define DEFAULT_AUDIT_INTERVAL 60  // Seconds between loan counter audits (0 = never)
+
+static volatile sig_atomic_t stats_requested = 0;
+
+// --- SIGUSR1: dump server statistics from the main loop ---
+void stats_handler(int s) {
+    (void)s;
+    stats_requested = 1;
+}
+
+void print_stats(void) {
+    struct WalStats wal;
+    char line[256];
+
+    stats_requested = 0;
+    wal_get_stats(&wal);
+    sprintf(line, "[SERVER] WAL: %llu commits, %llu fsyncs (%.2f commits/fsync), fsync avg %.1f us, max %.1f us, %llu checkpoints\n",
+            (unsigned long long)wal.commits, (unsigned long long)wal.fsyncs,
+            wal.fsyncs ? (double)wal.commits / wal.fsyncs : 0.0,
+            wal.fsyncs ? wal.fsync_ns_total / 1000.0 / wal.fsyncs : 0.0,
+            wal.fsync_ns_max / 1000.0, (unsigned long long)wal.checkpoints);
+    sys_write_string(line);
+
+    struct CommandStats commands[32];
+    int count = stats_snapshot(commands, 32);
+    for (int i = 0; i < count; i++) {
+        struct CommandStats *c = &commands[i];
+        sprintf(line, "[SERVER] %-19s %llu reqs, %llu errors, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us, lock wait %.1f us\n",
+                command_name(c->command), c->count, c->errors, c->p50_ns / 1000.0, c->p99_ns / 1000.0,
+                c->p999_ns / 1000.0, c->max_ns / 1000.0, c->lock_wait_ns / 1000.0);
+        sys_write_string(line);
+    }
+
+    struct HotAccountStats hot_accounts[64];
+    count = hot_accounts_snapshot(hot_accounts, 64);
+    for (int i = 0; i < count; i++) {
+        struct HotAccountStats *h = &hot_accounts[i];
+        sprintf(line, "[SERVER] Hot account %d (%s): %llu credits coalesced, %llu merges, %.2f pending\n",
+                h->account_id, h->designated ? "designated" : "detected", (unsigned long long)h->credits,
+                (unsigned long long)h->merges, h->pending);
+        sys_write_string(line);
+    }
+
+    struct LockSpaceStats spaces[LOCK_SPACES];
+    struct LockHotspot hot[LOCK_SPACES * 10];
+    int nspaces = 0;
+    count = lock_stats_snapshot(spaces, &nspaces, hot, 10);
+    for (int s = 0, h = 0; s < nspaces; s++) {
+        struct LockSpaceStats *l = &spaces[s];
+        sprintf(line, "[SERVER] Locks %-8s %llu acquired, %llu contended, wait %.1f us\n",
+                lock_space_name(l->space), l->acquisitions, l->contended, l->wait_ns / 1000.0);
+        sys_write_string(line);
+        for (; h < count && hot[h].space == l->space; h++) {
+            sprintf(line, "[SERVER]   hot %-8s #%-8d %llu waits, %.1f us (+/- %.1f us)\n",
+                    lock_space_name(hot[h].space), hot[h].record, hot[h].waits,
+                    hot[h].wait_ns / 1000.0, hot[h].error_ns / 1000.0);
+            sys_write_string(line);
+        }
+    }
+}
 
 // --- Signal Handler to Prevent Zombie Processes ---
 void sigchld_handler(int s) {
     (void)s; // Silence unused parameter warning
     int saved_errno = errno;
-    while(waitpid(-1, NULL, WNOHANG) > 0); 
+    pid_t pid;
+    int status;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        // A child that died abnormally may still hold record locks
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) lock_reap_process(pid);
+    }
     errno = saved_errno;
 }
 
-// --- Child Process Handler (Concurrency) ---
-void handle_client(int client_sd) {
-    struct Message request, response;
-    ssize_t bytes_read;
-    int logged_in = 0;
+// --- Command Dispatch (shared by fork mode and event mode) ---
+// Runs one request against the connection's session. serve_* functions send their own
+// reply; every other command gets the generic response written at the end.
+static void dispatch_command(struct Session *session, struct Message *request) {
+    struct Message response;
+    int client_sd = session->client_sd;
+    int protocol = session->protocol;
+    struct RingEnd *ring = NULL;
 
-    sys_write_string("\n[SERVER] Child process started. Waiting for login...\n");
+    memset(&response, 0, sizeof(response));
+    response.command = request->command;
+    if (session->batch != NULL && request->command != CMD_BATCH_TRANSFER) batch_discard(session);
 
-    while ((bytes_read = sys_read(client_sd, &request, sizeof(struct Message))) > 0) {
-        
-        // --- Command Dispatch ---
-        response.success_status = 0; 
-        response.command = request.command; 
-
-        switch (request.command) {
-            case CMD_LOGIN:
-                if (authenticate_and_set_user(request.data, request.data + MAX_NAME_LEN, request.source_id)) {
-                    logged_in = 1;
-                    response.success_status = 1;
-                    response.source_id = current_user.id;
-                    sys_write_string("[SERVER] Login successful.\n");
-                } else {
-                    sys_write_string("[SERVER] Login failed.\n");
-                }
-                break;
-                
-            case CMD_VIEW_BALANCE:
-                if (logged_in && current_user.role == CUSTOMER) {
-                    serve_view_balance(client_sd, &request);
-                    continue; 
-                } else {
-                    sys_write_string("[SERVER] Unauthorized attempt to view balance.\n");
-                }
-                break;
-            case CMD_APPLY_LOAN:
-            case CMD_VIEW_LOAN_STATUS:
-                if (logged_in && current_user.role == CUSTOMER) {
-                    if (request.command == CMD_APPLY_LOAN) {
-                        serve_apply_loan(client_sd, &request);
-                    } else {
-                        serve_view_loan_status(client_sd, &request);
-                    }
-                    continue; 
-                } else {
-                    sys_write_string("[SERVER] Unauthorized loan request.\n");
-                }
-                break;
+    switch (request->command) {
+        case CMD_LOGIN:
+            if (session->logged_in) {
+                // A second login replaces the first: its token must not outlive it
+                session_token_revoke(session->token);
+                session->token[0] = '\0';
+                session->logged_in = 0;
+                session->user.id = 0;
+            }
+            if (authenticate_and_set_user(session, request->data, request->data + MAX_NAME_LEN, request->source_id)) {
+                response.success_status = 1;
+                response.source_id = session->user.id;
+                strcpy(response.data, session->token);
+                if (session->user.role == EMPLOYEE) loan_queue_add_employee(session->user.id);
+                sys_write_string("[SERVER] Login successful.\n");
+            } else {
+                sys_write_string("[SERVER] Login failed.\n");
+            }
+            break;
 
-            // --- NEW: Employee Loan Commands ---
-            case CMD_PROCESS_LOAN:
-            case CMD_VIEW_ASSIGNED_LOANS:
-                if (logged_in && current_user.role == EMPLOYEE) {
-                    if (request.command == CMD_PROCESS_LOAN) {
-                        serve_process_loan(client_sd, &request);
-                    } else {
-                        serve_view_assigned_loans(client_sd, &request);
-                    }
-                    continue; 
+        case CMD_RESUME:
+            request->data[SESSION_TOKEN_LEN] = '\0';
+            if (!session->logged_in && resume_and_set_user(session, request->data)) {
+                response.success_status = 1;
+                response.source_id = session->user.id;
+                response.target_id = session->user.role;
+                strcpy(response.data, session->token);
+            } else {
+                strcpy(response.data, "Session expired or revoked; log in again.");
+            }
+            break;
+
+        case CMD_VIEW_BALANCE:
+            if (session->logged_in && session->user.role == CUSTOMER) {
+                request->source_id = session->user.id; // A customer's account ID is their user ID
+                serve_view_balance(client_sd, request);
+                return;
+            } else {
+                sys_write_string("[SERVER] Unauthorized attempt to view balance.\n");
+            }
+            break;
+        case CMD_APPLY_LOAN:
+        case CMD_VIEW_LOAN_STATUS:
+            if (session->logged_in && session->user.role == CUSTOMER) {
+                request->source_id = session->user.id; // Customers apply for and see only their own loans
+                if (request->command == CMD_APPLY_LOAN) {
+                    serve_apply_loan(client_sd, request);
                 } else {
-                    sys_write_string("[SERVER] Unauthorized loan processing request.\n");
+                    serve_view_loan_status(client_sd, request);
                 }
-            case CMD_DEPOSIT:
-            case CMD_WITHDRAW:
-                if (logged_in && current_user.role == CUSTOMER) {
-                    if (request.command == CMD_DEPOSIT) {
-                        serve_deposit(client_sd, &request);
-                    } else {
-                        serve_withdraw(client_sd, &request);
-                    }
-                    continue; 
+                return;
+            } else {
+                sys_write_string("[SERVER] Unauthorized loan request.\n");
+            }
+            break;
+
+        // --- NEW: Employee Loan Commands ---
+        case CMD_PROCESS_LOAN:
+        case CMD_VIEW_ASSIGNED_LOANS:
+        case CMD_CLAIM_LOAN:
+            if (session->logged_in && session->user.role == EMPLOYEE) {
+                request->source_id = session->user.id; // Employees always act as themselves
+                if (request->command == CMD_PROCESS_LOAN) {
+                    serve_process_loan(client_sd, request);
+                } else if (request->command == CMD_CLAIM_LOAN) {
+                    serve_claim_loan(client_sd, request);
                 } else {
-                    sys_write_string("[SERVER] Unauthorized attempt to perform transaction.\n");
+                    serve_view_assigned_loans(client_sd, request);
                 }
-                break;
-            case CMD_ADD_CUSTOMER: // New Employee command
-            case CMD_MODIFY_CUSTOMER: // New Employee command
-                if (logged_in && current_user.role == EMPLOYEE) {
-                    if (request.command == CMD_ADD_CUSTOMER) {
-                        serve_add_customer(client_sd, &request);
-                    } else {
-                        serve_modify_customer(client_sd, &request);
-                    }
-                    continue; 
+                return;
+            } else {
+                sys_write_string("[SERVER] Unauthorized loan processing request.\n");
+            }
+            break;
+        case CMD_DEPOSIT:
+        case CMD_WITHDRAW:
+            if (session->logged_in && session->user.role == CUSTOMER) {
+                request->source_id = session->user.id; // Only the customer's own account
+                if (request->command == CMD_DEPOSIT) {
+                    serve_deposit(client_sd, request);
                 } else {
-                    sys_write_string("[SERVER] Unauthorized attempt to modify customer data.\n");
+                    serve_withdraw(client_sd, request);
                 }
-                break;
-            
-            case CMD_TRANSFER: // Transfer Logic
-                if (logged_in && current_user.role == CUSTOMER) {
-                    serve_transfer(client_sd, &request);
-                    continue;
+                return;
+            } else {
+                sys_write_string("[SERVER] Unauthorized attempt to perform transaction.\n");
+            }
+            break;
+        case CMD_ADD_CUSTOMER: // New Employee command
+        case CMD_MODIFY_CUSTOMER: // New Employee command
+            if (session->logged_in && session->user.role == EMPLOYEE) {
+                if (request->command == CMD_ADD_CUSTOMER) {
+                    serve_add_customer(client_sd, request);
                 } else {
-                    sys_write_string("[SERVER] Unauthorized attempt to transfer funds.\n");
+                    serve_modify_customer(client_sd, request);
                 }
-                break;
+                return;
+            } else {
+                sys_write_string("[SERVER] Unauthorized attempt to modify customer data.\n");
+            }
+            break;
+
+        case CMD_VIEW_HISTORY:
+            if (session->logged_in && (session->user.role == CUSTOMER || session->user.role == EMPLOYEE)) {
+                // Customers only page through their own history; employees name the account
+                if (session->user.role == CUSTOMER) request->source_id = session->user.id;
+                serve_view_history(client_sd, request);
+                return;
+            } else {
+                sys_write_string("[SERVER] Unauthorized attempt to view transaction history.\n");
+            }
+            break;
+
+        case CMD_STATS:
+            if (session->logged_in && session->user.role == ADMINISTRATOR) {
+                serve_stats(client_sd, request);
+                return;
+            } else {
+                sys_write_string("[SERVER] Unauthorized attempt to read server statistics.\n");
+            }
+            break;
 
-            case CMD_LOGOUT:
-                logged_in = 0;
-                current_user.id = 0;
+        case CMD_LOCK_STATS:
+            if (session->logged_in && session->user.role == ADMINISTRATOR) {
+                serve_lock_stats(client_sd, request);
+                return;
+            } else {
+                sys_write_string("[SERVER] Unauthorized attempt to read lock statistics.\n");
+            }
+            break;
+
+        case CMD_ACCRUE_INTEREST:
+            if (session->logged_in && session->user.role == ADMINISTRATOR) {
+                serve_accrue_interest(client_sd, request);
+                return;
+            } else {
+                sys_write_string("[SERVER] Unauthorized attempt to run interest accrual.\n");
+            }
+            break;
+
+        case CMD_TRANSFER: // Transfer Logic
+            if (session->logged_in && session->user.role == CUSTOMER) {
+                request->source_id = session->user.id; // Always pays from the caller's account
+                serve_transfer(client_sd, request);
+                return;
+            } else {
+                sys_write_string("[SERVER] Unauthorized attempt to transfer funds.\n");
+            }
+            break;
+
+        case CMD_BATCH_TRANSFER:
+            if (session->logged_in && session->user.role == CUSTOMER) {
+                serve_batch_transfer(session, request); // Always pays from the caller's account
+                return;
+            } else {
+                sys_write_string("[SERVER] Unauthorized attempt to run a batch transfer.\n");
+            }
+            break;
+
+        case CMD_HELLO:
+            // Answered in the current protocol; the connection switches once it is queued
+            if (request->target_id >= WIRE_FIXED) {
+                protocol = (request->target_id < WIRE_VERSION) ? request->target_id : WIRE_VERSION;
+                response.target_id = protocol;
                 response.success_status = 1;
-                sys_write_string("[SERVER] User logged out.\n");
-                break;
-                
-            default:
-                sys_write_string("[SERVER] Unknown command received.\n");
-                break;
+            }
+            break;
+
+        case CMD_RING_ATTACH:
+            // The descriptors came with this request over an AF_UNIX socket
+            if (session->ring == NULL && session->ring_pending == NULL && session->npassed == RING_FDS) {
+                ring = ring_attach(session->passed_fds);
+                session->npassed = 0;
+            }
+            if (ring != NULL) {
+                response.success_status = 1;
+            } else {
+                strcpy(response.data, "Ring attach needs a local connection and its descriptors.");
+            }
+            break;
+
+        case CMD_SET_ACCOUNT_STATUS:
+            if (session->logged_in && session->user.role == MANAGER) {
+                serve_set_account_status(client_sd, request);
+                return;
+            } else {
+                sys_write_string("[SERVER] Unauthorized attempt to change an account status.\n");
+            }
+            break;
+
+        case CMD_LIST_LOANS:
+            if (session->logged_in && (session->user.role == EMPLOYEE || session->user.role == MANAGER)) {
+                serve_list_loans(client_sd, request);
+                return;
+            } else {
+                sys_write_string("[SERVER] Unauthorized attempt to list loans.\n");
+            }
+            break;
+
+        case CMD_ASSIGN_LOANS:
+            if (session->logged_in && session->user.role == MANAGER) {
+                serve_assign_loans(client_sd, request);
+                return;
+            } else {
+                sys_write_string("[SERVER] Unauthorized attempt to assign loans.\n");
+            }
+            break;
+
+        case CMD_LOGOUT:
+            session_token_revoke(session->token);
+            session->token[0] = '\0';
+            session->logged_in = 0;
+            session->user.id = 0;
+            response.success_status = 1;
+            sys_write_string("[SERVER] User logged out.\n");
+            break;
+
+        default:
+            sys_write_string("[SERVER] Unknown command received.\n");
+            break;
+    }
+
+    // Send generic response back to client (for commands like LOGIN, LOGOUT)
+    send_response(client_sd, &response);
+    session->protocol = protocol;
+    if (ring != NULL) session->ring_pending = ring; // Switch once this reply has left on the socket
+}
+
+// --- Transport: the socket, or the shared-memory ring a local client attached ---
+static void session_drop_fds(struct Session *session) {
+    for (int i = 0; i < session->npassed; i++) sys_close(session->passed_fds[i]);
+    session->npassed = 0;
+}
+
+// Reads from the socket like read(), keeping descriptors passed for CMD_RING_ATTACH.
+static ssize_t session_recv(struct Session *session, void *buf, size_t len) {
+    int fds[RING_FDS], nfds;
+    ssize_t n = recv_fds(session->client_sd, buf, len, fds, RING_FDS, &nfds);
+    if (nfds > 0) {
+        session_drop_fds(session);
+        memcpy(session->passed_fds, fds, nfds * sizeof(int));
+        session->npassed = nfds;
+    }
+    return n;
+}
+
+static void session_close_transport(struct Session *session) {
+    session_drop_fds(session);
+    ring_detach(session->ring);
+    ring_detach(session->ring_pending);
+    session->ring = session->ring_pending = NULL;
+}
+
+// Times every request into its command's shared latency histogram (see utils.c X).
+// bytes_in is the size of the request on the wire.
+void dispatch_request(struct Session *session, struct Message *request, size_t bytes_in) {
+    int command = request->command;
+    uint64_t start = stats_clock();
+    set_reply_request_id(request->request_id);
+    set_reply_protocol(session->protocol);
+    dispatch_command(session, request);
+    stats_record(command, start, bytes_in);
+}
+
+// Appends len bytes to a growable reply buffer. Returns -1 when out of memory.
+static int out_append(char **buf, size_t *len, size_t *cap, const void *data, size_t n) {
+    if (*len + n > *cap) {
+        size_t new_cap = *cap ? *cap : OUT_BUF_INIT;
+        while (new_cap < *len + n) new_cap *= 2;
+        char *grown = realloc(*buf, new_cap);
+        if (grown == NULL) return -1;
+        *buf = grown;
+        *cap = new_cap;
+    }
+    memcpy(*buf + *len, data, n);
+    *len += n;
+    return 0;
+}
+
+// --- Child Process Handler (Fork Mode) ---
+// Clients may pipeline: every complete request a read delivers is dispatched in order,
+// and their replies go out together after one group commit, in a single write. A
+// malformed compact frame ends the connection. On a ring the child spins briefly before
+// sleeping, so a busy client is served without system calls.
+static char *child_out = NULL;
+static size_t child_out_len = 0, child_out_cap = 0;
+
+static ssize_t child_reply(int client_sd, const void *buf, size_t len) {
+    (void)client_sd;
+    return (out_append(&child_out, &child_out_len, &child_out_cap, buf, len) == -1) ? -1 : (ssize_t)len;
+}
+
+// Blocking read from the session's transport; 0 once the client is gone.
+static ssize_t child_receive(struct Session *session, void *buf, size_t len) {
+    if (session->ring == NULL) return session_recv(session, buf, len);
+    ssize_t n;
+    while ((n = ring_read(session->ring, buf, len)) == 0) {
+        if (ring_wait(session->ring, session->client_sd, 1, 0) == -1) return 0;
+    }
+    return n;
+}
+
+static int child_send(struct Session *session, const char *buf, size_t len) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t n;
+        if (session->ring != NULL) {
+            n = ring_write(session->ring, buf + sent, len - sent);
+            if (n == 0 && ring_wait(session->ring, session->client_sd, 0, 1) == 0) continue;
+        } else {
+            n = sys_write(session->client_sd, buf + sent, len - sent);
+            if (n < 0 && errno == EINTR) continue;
+        }
+        if (n <= 0) return -1;
+        sent += n;
+    }
+    return 0;
+}
+
+void handle_client(int client_sd) {
+    char in_buf[IN_BUF_MESSAGES * sizeof(struct Message)];
+    size_t in_len = 0;
+    struct Session session = {};
+    ssize_t bytes_read, n = 0;
+
+    session.client_sd = client_sd;
+    set_reply_hook(child_reply);
+    wal_set_deferred(1);
+    sys_write_string("\n[SERVER] Child process started. Waiting for login...\n");
+
+    while (n >= 0 && (bytes_read = child_receive(&session, in_buf + in_len, sizeof(in_buf) - in_len)) > 0) {
+        struct Message request;
+        size_t used = 0;
+        in_len += bytes_read;
+        while ((n = wire_read_request(&session, in_buf + used, in_len - used, &request)) > 0) {
+            used += n;
+            dispatch_request(&session, &request, n);
         }
+        memmove(in_buf, in_buf + used, in_len - used);
+        in_len -= used;
 
-        // Send generic response back to client (for commands like LOGIN, LOGOUT)
-        sys_write(client_sd, &response, sizeof(struct Message));
+        if (wal_sync_pending() == -1) {
+            perror("[SERVER] WAL sync failed"); // Never acknowledge changes that may be lost
+            exit(EXIT_FAILURE);
+        }
+        journal_flush();
+        if (child_send(&session, child_out, child_out_len) == -1) break;
+        child_out_len = 0;
+        if (session.ring_pending != NULL) {
+            session.ring = session.ring_pending;
+            session.ring_pending = NULL;
+        }
     }
 
+    batch_discard(&session);
+    session_close_transport(&session);
     sys_write_string("[SERVER] Client disconnected. Child process exiting.\n");
     sys_close(client_sd);
-    exit(0); 
+    exit(0);
+}
+
+
+// ====================================================================
+// EVENT MODE: NON-BLOCKING EPOLL LOOP
+// ====================================================================
+// Every connection is a small state machine driven by readiness events:
+//   CONN_READING -> complete requests are buffered -> dispatch each in order -> replies queued
+//   CONN_CLOSING -> peer hung up; drop the connection once the output buffer drains
+// A client may have many requests in flight. Each read takes up to IN_BUF_MESSAGES of
+// them, and all replies queued during a loop iteration leave in one write. A client
+// that does not read its replies stops being read once OUT_BUF_HIGH_WATER bytes wait.
+// A connection on a ring is driven by its eventfd instead (registered under that fd in
+// the connection table); its socket only signals hang-up. A ring still holding work
+// after a flush goes on the busy list and is served again without waiting.
+
+#define CONN_READING 1
+#define CONN_CLOSING 2
+
+struct Connection {
+    struct Session session;
+    int state;
+    int dirty;                           // Queued on the post-iteration flush list
+    char in_buf[IN_BUF_MESSAGES * sizeof(struct Message)]; // Request bytes not yet dispatched
+    size_t in_len;
+    char *out_buf;                       // Replies not yet accepted by the socket
+    size_t out_len;
+    size_t out_cap;
+    int want_write;                      // EPOLLOUT currently registered
+    int want_read;                       // EPOLLIN currently registered
+    int busy;                            // On the busy ring list
+};
+
+static int epoll_fd = -1;
+static struct Connection **connections = NULL; // Indexed by socket descriptor
+static int connections_cap = 0;
+static int open_connections = 0;
+static int *dirty_fds = NULL;  // Connections to flush once this iteration's commits are durable
+static int dirty_count = 0;
+static int dirty_cap = 0;
+static int *busy_fds = NULL;   // Ring connections to serve next iteration without sleeping
+static int busy_count = 0;
+static int busy_cap = 0;
+static int accepted_total = 0; // Lifetime accepts, checked against the worker's budget
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int connections_reserve(int fd) {
+    if (fd >= connections_cap) {
+        int new_cap = connections_cap ? connections_cap : 1024;
+        while (new_cap <= fd) new_cap *= 2;
+        struct Connection **grown = realloc(connections, new_cap * sizeof(struct Connection *));
+        if (grown == NULL) return -1;
+        memset(grown + connections_cap, 0, (new_cap - connections_cap) * sizeof(struct Connection *));
+        connections = grown;
+        connections_cap = new_cap;
+    }
+    return 0;
+}
+
+static int fd_list_add(int **list, int *count, int *cap, int fd) {
+    if (*count == *cap) {
+        int new_cap = *cap ? *cap * 2 : MAX_EVENTS;
+        int *grown = realloc(*list, new_cap * sizeof(int));
+        if (grown == NULL) return -1;
+        *list = grown;
+        *cap = new_cap;
+    }
+    (*list)[(*count)++] = fd;
+    return 0;
+}
+
+static struct Connection *conn_open(int client_sd) {
+    if (connections_reserve(client_sd) == -1) return NULL;
+
+    struct Connection *conn = calloc(1, sizeof(struct Connection));
+    if (conn == NULL) return NULL;
+    conn->session.client_sd = client_sd;
+    conn->state = CONN_READING;
+    conn->want_read = 1;
+    connections[client_sd] = conn;
+    open_connections++;
+    return conn;
+}
+
+static void conn_close(struct Connection *conn) {
+    int client_sd = conn->session.client_sd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_sd, NULL);
+    sys_close(client_sd);
+    connections[client_sd] = NULL;
+    if (conn->session.ring != NULL) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->session.ring->wait_fd, NULL);
+        connections[conn->session.ring->wait_fd] = NULL;
+    }
+    open_connections--;
+    batch_discard(&conn->session);
+    session_close_transport(&conn->session);
+    free(conn->out_buf);
+    free(conn);
+    sys_write_string("[SERVER] Client disconnected.\n");
+}
+
+static void conn_update_events(struct Connection *conn) {
+    if (conn->session.ring != NULL) return; // Only hang-up is watched on the socket
+    int want_write = conn->out_len > 0;
+    int want_read = conn->out_len < OUT_BUF_HIGH_WATER;
+    if (want_write == conn->want_write && want_read == conn->want_read) return;
+
+    struct epoll_event ev = {};
+    ev.events = (want_read ? EPOLLIN | EPOLLRDHUP : 0) | (want_write ? EPOLLOUT : 0);
+    ev.data.fd = conn->session.client_sd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->session.client_sd, &ev);
+    conn->want_write = want_write;
+    conn->want_read = want_read;
+}
+
+// Pushes as much of the output buffer as the socket will take. Returns -1 on a hard error.
+static int conn_flush(struct Connection *conn) {
+    size_t sent = 0;
+    while (sent < conn->out_len) {
+        ssize_t n;
+        if (conn->session.ring != NULL) {
+            n = ring_write(conn->session.ring, conn->out_buf + sent, conn->out_len - sent);
+            if (n == 0) break; // Full: the client wakes us when it makes room
+            if (n < 0) return -1;
+            sent += n;
+            continue;
+        }
+        n = sys_write(conn->session.client_sd, conn->out_buf + sent, conn->out_len - sent);
+        if (n > 0) { sent += n; continue; }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        return -1;
+    }
+    if (sent > 0) {
+        memmove(conn->out_buf, conn->out_buf + sent, conn->out_len - sent);
+        conn->out_len -= sent;
+    }
+    conn_update_events(conn);
+    return 0;
+}
+
+// Reply hook installed in event mode: serve_* replies are appended to the connection's
+// output buffer and flushed opportunistically instead of blocking the whole loop.
+static ssize_t event_reply(int client_sd, const void *buf, size_t len) {
+    struct Connection *conn = (client_sd < connections_cap) ? connections[client_sd] : NULL;
+    if (conn == NULL) return -1;
+    if (out_append(&conn->out_buf, &conn->out_len, &conn->out_cap, buf, len) == -1) return -1;
+    return (ssize_t)len;
+}
+
+static void conn_mark_dirty(struct Connection *conn) {
+    if (conn->dirty) return;
+    if (fd_list_add(&dirty_fds, &dirty_count, &dirty_cap, conn->session.client_sd) == 0) conn->dirty = 1;
+}
+
+static void conn_mark_busy(struct Connection *conn) {
+    if (conn->busy) return;
+    if (fd_list_add(&busy_fds, &busy_count, &busy_cap, conn->session.client_sd) == 0) conn->busy = 1;
+}
+
+// The attach reply has left on the socket: serve the connection from its ring from now on.
+static void conn_start_ring(struct Connection *conn) {
+    struct RingEnd *ring = conn->session.ring_pending;
+    struct epoll_event ev = {};
+    conn->session.ring_pending = NULL;
+    ev.events = EPOLLIN;
+    ev.data.fd = ring->wait_fd;
+    if (connections_reserve(ring->wait_fd) == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ring->wait_fd, &ev) < 0) {
+        ring_detach(ring);
+        conn->state = CONN_CLOSING;
+        return;
+    }
+    connections[ring->wait_fd] = conn;
+    conn->session.ring = ring;
+    ev.events = EPOLLRDHUP;
+    ev.data.fd = conn->session.client_sd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->session.client_sd, &ev);
+    conn_mark_busy(conn); // Requests may already be waiting
+}
+
+static void conn_on_readable(struct Connection *conn) {
+    while (conn->state == CONN_READING && conn->out_len < OUT_BUF_HIGH_WATER && conn->session.ring_pending == NULL) {
+        ssize_t n = (conn->session.ring != NULL) ?
+                    ring_read(conn->session.ring, conn->in_buf + conn->in_len, sizeof(conn->in_buf) - conn->in_len) :
+                    session_recv(&conn->session, conn->in_buf + conn->in_len, sizeof(conn->in_buf) - conn->in_len);
+        if (n > 0) {
+            struct Message request;
+            size_t used = 0;
+            conn->in_len += n;
+            while ((n = wire_read_request(&conn->session, conn->in_buf + used, conn->in_len - used, &request)) > 0) {
+                used += n;
+                dispatch_request(&conn->session, &request, n);
+            }
+            memmove(conn->in_buf, conn->in_buf + used, conn->in_len - used);
+            conn->in_len -= used;
+            if (n < 0) conn->state = CONN_CLOSING; // Malformed frame: answer what came before it
+            continue;
+        }
+        if (conn->session.ring != NULL) {
+            if (n < 0) conn->state = CONN_CLOSING; // Corrupted ring
+            break;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        conn->state = CONN_CLOSING; // EOF or hard error
+    }
+    conn_mark_dirty(conn);
+}
+
+// End of a loop iteration: make this iteration's balance changes durable with one
+// group commit, then release the replies that were waiting on it.
+static void flush_dirty_connections(void) {
+    if (wal_sync_pending() == -1) {
+        // Replies already promise success; never send them for changes that may be lost
+        perror("[SERVER] WAL sync failed");
+        exit(EXIT_FAILURE);
+    }
+    journal_flush(); // One batch of history records per iteration
+
+    for (int i = 0; i < dirty_count; i++) {
+        struct Connection *conn = connections[dirty_fds[i]];
+        if (conn == NULL) continue;
+        conn->dirty = 0;
+        if (conn_flush(conn) < 0 || (conn->state == CONN_CLOSING && conn->out_len == 0)) {
+            conn_close(conn);
+            continue;
+        }
+        if (conn->session.ring_pending != NULL && conn->out_len == 0) conn_start_ring(conn);
+        struct RingEnd *ring = conn->session.ring;
+        if (ring != NULL && conn->state == CONN_READING &&
+            !ring_idle(ring, conn->out_len < OUT_BUF_HIGH_WATER, conn->out_len > 0)) {
+            conn_mark_busy(conn);
+        }
+    }
+    dirty_count = 0;
+}
+
+static void print_accepted(const struct sockaddr_storage *addr) {
+    if (addr->ss_family == AF_UNIX) {
+        printf("[SERVER] Connection accepted on the local socket\n");
+        return;
+    }
+    const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+    printf("[SERVER] Connection accepted from %s:%d\n", inet_ntoa(in->sin_addr), ntohs(in->sin_port));
+}
+
+static void accept_pending(int listen_sd) {
+    struct sockaddr_storage client_addr;
+    socklen_t client_len;
+
+    while (1) {
+        client_len = sizeof(client_addr);
+        int client_sd = sys_accept(listen_sd, (struct sockaddr *)&client_addr, &client_len);
+        if (client_sd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("[SERVER] Accept failed");
+            return;
+        }
+
+        if (set_nonblocking(client_sd) < 0 || conn_open(client_sd) == NULL) {
+            sys_close(client_sd);
+            continue;
+        }
+
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = client_sd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_sd, &ev) < 0) {
+            perror("[SERVER] epoll_ctl add failed");
+            conn_close(connections[client_sd]);
+            continue;
+        }
+        accepted_total++;
+        print_accepted(&client_addr);
+    }
+}
+
+static void watch_listener(int sd, uint32_t flags) {
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | flags;
+    ev.data.fd = sd;
+    if (set_nonblocking(sd) < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sd, &ev) < 0) {
+        perror("[SERVER] epoll_ctl listen failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void retire_listener(int *sd) {
+    if (*sd < 0) return;
+    accept_pending(*sd); // Take whatever is already queued
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, *sd, NULL);
+    sys_close(*sd);
+    *sd = -1;
+}
+
+// Serves ring connections that still had work after the last flush.
+static void serve_busy_rings(void) {
+    int count = busy_count;
+    busy_count = 0;
+    for (int i = 0; i < count; i++) {
+        struct Connection *conn = connections[busy_fds[i]];
+        if (conn == NULL) continue;
+        conn->busy = 0;
+        conn_on_readable(conn);
+    }
+}
+
+// Runs until the process is killed, or, when max_conns > 0, until max_conns connections
+// have been accepted and every one of them has closed. A worker that reaches its budget
+// stops listening (the kernel then spreads new connections over the remaining
+// SO_REUSEPORT listeners) and returns once its last session ends. unix_sd is the
+// AF_UNIX listener, or -1; prefork workers share one, so only one of them is woken per
+// connection.
+void run_event_loop(int listen_sd, int unix_sd, int max_conns) {
+    struct epoll_event events[MAX_EVENTS];
+
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        perror("[SERVER] Event loop setup failed");
+        exit(EXIT_FAILURE);
+    }
+    watch_listener(listen_sd, 0);
+    if (unix_sd >= 0) watch_listener(unix_sd, (max_conns > 0) ? EPOLLEXCLUSIVE : 0);
+
+    set_reply_hook(event_reply);
+    wal_set_deferred(1);
+
+    unsigned int busy_loops = 0;
+    while (listen_sd >= 0 || unix_sd >= 0 || open_connections > 0) {
+        int n = 0;
+        if (busy_count == 0 || ++busy_loops % BUSY_EPOLL_EVERY == 0) { // Busy rings need no syscall
+            n = epoll_wait(epoll_fd, events, MAX_EVENTS, busy_count > 0 ? 0 : -1);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                if (stats_requested) print_stats();
+                continue;
+            }
+            perror("[SERVER] epoll_wait failed");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listen_sd || fd == unix_sd) {
+                accept_pending(fd);
+                if (max_conns > 0 && accepted_total >= max_conns) {
+                    // Budget spent: stop listening
+                    retire_listener(&listen_sd);
+                    retire_listener(&unix_sd);
+                    printf("[SERVER] Worker %d retiring after %d connections.\n", (int)getpid(), accepted_total);
+                }
+                continue;
+            }
+
+            struct Connection *conn = (fd < connections_cap) ? connections[fd] : NULL;
+            if (conn == NULL) continue;
+
+            if (conn->session.ring != NULL) {
+                if (fd == conn->session.client_sd) {
+                    conn->state = CONN_CLOSING; // Hung up: nothing else arrives on the socket
+                    conn_mark_dirty(conn);
+                } else {
+                    ring_resume(conn->session.ring);
+                    conn_on_readable(conn); // Also flushes replies that waited for room
+                }
+            } else if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                conn_on_readable(conn);
+            } else if (events[i].events & EPOLLOUT) {
+                conn_mark_dirty(conn);
+            }
+        }
+        serve_busy_rings();
+        flush_dirty_connections();
+    }
+}
+
+
+// ====================================================================
+// PREFORK MODE: SUPERVISED WORKER POOL
+// ====================================================================
+// The master never accepts. Each worker binds its own SO_REUSEPORT listener, so the
+// kernel load-balances new connections across workers without a shared accept lock,
+// and serves many connections over its lifetime through the event loop above. The
+// master only reaps and respawns workers (the job sigchld_handler does in fork mode).
+
+static volatile sig_atomic_t shutdown_requested = 0;
+static pid_t auditor_pid = -1; // Loan counter auditor, if running
+static pid_t accrual_pid = -1; // Interest accrual runner
+
+static void shutdown_handler(int s) {
+    (void)s;
+    shutdown_requested = 1;
+}
+
+int open_listener(int reuseport, int backlog) {
+    struct sockaddr_in server_addr;
+    int one = 1;
+
+    int listen_sd = sys_socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_sd < 0) return -1;
+
+    setsockopt(listen_sd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (reuseport && setsockopt(listen_sd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        sys_close(listen_sd);
+        return -1;
+    }
+
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(PORT);
+
+    if (sys_bind(listen_sd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 ||
+        (backlog > 0 && sys_listen(listen_sd, backlog) < 0)) {
+        sys_close(listen_sd);
+        return -1;
+    }
+    return listen_sd;
+}
+
+// Listener for co-located clients on a filesystem path; a stale socket file left by an
+// earlier run is replaced.
+int open_unix_listener(const char *path, int backlog) {
+    struct sockaddr_un addr = {};
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int listen_sd = sys_socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_sd < 0) return -1;
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (sys_bind(listen_sd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || sys_listen(listen_sd, backlog) < 0) {
+        sys_close(listen_sd);
+        return -1;
+    }
+    return listen_sd;
+}
+
+static pid_t spawn_worker(int unix_sd, int max_conns) {
+    sigset_t block, saved;
+
+    // Hold shutdown signals across fork so a worker cannot run the master's handler
+    sigemptyset(&block);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGINT);
+    sigprocmask(SIG_BLOCK, &block, &saved);
+
+    pid_t pid = fork();
+    if (pid != 0) {
+        sigprocmask(SIG_SETMASK, &saved, NULL);
+        return pid; // Parent (or fork failure)
+    }
+
+    // Worker: default signal dispositions, own listener, event loop until retired
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    sigprocmask(SIG_SETMASK, &saved, NULL);
+    id_reset_blocks();
+    int listen_sd = open_listener(1, EVENT_BACKLOG);
+    if (listen_sd < 0) {
+        perror("[SERVER] Worker listener setup failed");
+        exit(EXIT_FAILURE);
+    }
+    run_event_loop(listen_sd, unix_sd, max_conns);
+    exit(0);
+}
+
+// unix_sd, if not -1, is shared by every worker (AF_UNIX has no SO_REUSEPORT balancing).
+void run_prefork_master(int pool_size, int unix_sd, int max_conns) {
+    pid_t *workers = calloc(pool_size, sizeof(pid_t));
+    if (workers == NULL) {
+        perror("[SERVER] Worker table allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Master reaps explicitly below, so drop the fork-mode SIGCHLD handler
+    signal(SIGCHLD, SIG_DFL);
+
+    struct sigaction sa;
+    sa.sa_handler = shutdown_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0; // Let waitpid return EINTR so shutdown is noticed
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    for (int i = 0; i < pool_size; i++) {
+        workers[i] = spawn_worker(unix_sd, max_conns);
+        if (workers[i] < 0) perror("[SERVER] Fork failed");
+    }
+
+    while (!shutdown_requested) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                if (stats_requested) print_stats();
+                continue;
+            }
+            if (errno == ECHILD) sleep(RESPAWN_BACKOFF_SEC); // Every fork failed; try again
+        }
+
+        for (int i = 0; i < pool_size; i++) {
+            if (pid > 0 && workers[i] != pid) continue;
+            if (pid < 0 && workers[i] > 0) continue;
+
+            if (pid > 0 && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+                printf("[SERVER] Worker %d died unexpectedly, respawning.\n", (int)pid);
+                lock_reap_process(pid); // Free any record locks it died holding
+                sleep(RESPAWN_BACKOFF_SEC); // Avoid a tight crash/respawn loop
+            }
+            workers[i] = spawn_worker(unix_sd, max_conns);
+            if (workers[i] < 0) perror("[SERVER] Fork failed");
+            if (pid > 0) break;
+        }
+    }
+
+    printf("[SERVER] Shutting down worker pool.\n");
+    for (int i = 0; i < pool_size; i++) {
+        if (workers[i] > 0) kill(workers[i], SIGTERM);
+    }
+    if (auditor_pid > 0) kill(auditor_pid, SIGTERM);
+    if (accrual_pid > 0) kill(accrual_pid, SIGTERM);
+    while (waitpid(-1, NULL, 0) > 0);
+    if (unix_sd >= 0) sys_close(unix_sd);
+    free(workers);
+}
+
+
+// Recounts loans.dat every interval seconds and repairs the loan counters, in a child of
+// its own so the scan never holds up a client. It dies with the server.
+static void spawn_loan_auditor(int interval) {
+    pid_t server_pid = getpid();
+    fflush(stdout); // The child inherits stdio buffers across fork
+    pid_t pid = fork();
+    if (pid < 0) perror("[SERVER] Loan auditor fork failed");
+    if (pid != 0) {
+        auditor_pid = pid;
+        return;
+    }
+
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGUSR1, SIG_IGN);
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != server_pid) exit(0); // Server exited before prctl took effect
+    for (;;) {
+        sleep(interval);
+        int fixed = loan_counters_audit();
+        if (fixed > 0) {
+            printf("[SERVER] Loan counter audit repaired %d counter(s).\n", fixed);
+            fflush(stdout);
+        }
+    }
+}
+
+// Runs end-of-day interest accrual (utils.c XVII) in a child of its own, with workers
+// of its own, and resumes a run a crash interrupted. It dies with the server.
+static void spawn_accrual_runner(double annual_pct, int workers) {
+    pid_t server_pid = getpid();
+    fflush(stdout); // The child inherits stdio buffers across fork
+    pid_t pid = fork();
+    if (pid < 0) perror("[SERVER] Interest accrual fork failed");
+    if (pid != 0) {
+        accrual_pid = pid;
+        return;
+    }
+
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGUSR1, SIG_IGN);
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != server_pid) exit(0); // Server exited before prctl took effect
+    accrual_runner(annual_pct, workers);
 }
 
 // --- Main Server Setup ---
-int main() {
-    int listen_sd, client_sd;
-    struct sockaddr_in server_addr, client_addr;
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-m fork|event|prefork] [-n workers] [-c max_conns] [-s none|async|sync] [-b id_block] [-g usec]\n"
+                    "          [-H ids|auto|none] [-u path] [-T sec] [-A sec] [-q age|amount] [-I pct] [-j workers]\n", prog);
+    fprintf(stderr, "  -m fork     one child process per connection (default)\n");
+    fprintf(stderr, "  -m event    single process, non-blocking epoll event loop\n");
+    fprintf(stderr, "  -m prefork  pool of event-loop workers on SO_REUSEPORT listeners\n");
+    fprintf(stderr, "  -n N        prefork pool size (default %d)\n", DEFAULT_POOL_SIZE);
+    fprintf(stderr, "  -c N        connections per worker before it is recycled, 0 = never (default %d)\n", DEFAULT_MAX_CONNS);
+    fprintf(stderr, "  -s POLICY   account store durability: none (kernel writeback, default),\n");
+    fprintf(stderr, "              async (msync MS_ASYNC per update) or sync (msync MS_SYNC per update)\n");
+    fprintf(stderr, "  -b N        IDs each process reserves from ids.seq at a time (default 1)\n");
+    fprintf(stderr, "  -g USEC     group commit window: how long a WAL flusher waits for more\n");
+    fprintf(stderr, "              commits before fdatasync (default 0)\n");
+    fprintf(stderr, "  -H LIST     hot accounts whose credits are coalesced: account IDs and/or\n");
+    fprintf(stderr, "              auto (detect from lock contention) or none (default auto)\n");
+    fprintf(stderr, "  -u PATH     also listen on an AF_UNIX socket at PATH; clients there may move\n");
+    fprintf(stderr, "              to a shared-memory ring (default: TCP only)\n");
+    fprintf(stderr, "  -T SEC      session tokens stay resumable this long unused, 0 = no tokens\n");
+    fprintf(stderr, "              (default %d)\n", DEFAULT_SESSION_TTL);
+    fprintf(stderr, "  -A SEC      recount loans.dat this often and repair the loan counters,\n");
+    fprintf(stderr, "              0 = never (default %d)\n", DEFAULT_AUDIT_INTERVAL);
+    fprintf(stderr, "  -q ORDER    unassigned loans go out oldest first (age, default) or largest\n");
+    fprintf(stderr, "              amount first (amount)\n");
+    fprintf(stderr, "  -I PCT      accrue interest at PCT a year on every active account each night,\n");
+    fprintf(stderr, "              0 = only when an administrator asks (default 0)\n");
+    fprintf(stderr, "  -j N        interest accrual workers (default: one per online CPU)\n");
+    fprintf(stderr, "Send SIGUSR1 to print WAL commit and per-command latency statistics.\n");
+}
+
+int main(int argc, char *argv[]) {
+    int listen_sd, client_sd, unix_sd = -1;
+    struct sockaddr_in server_addr;
+    struct sockaddr_storage client_addr;
     socklen_t client_len = sizeof(client_addr);
-    
+    int mode = MODE_FORK;
+    int pool_size = DEFAULT_POOL_SIZE;
+    int max_conns = DEFAULT_MAX_CONNS;
+    int durability = STORE_SYNC_NONE;
+    int commit_window = 0;
+    char hot_list[256] = "auto";
+    const char *unix_path = NULL;
+    int session_ttl = DEFAULT_SESSION_TTL;
+    int audit_interval = DEFAULT_AUDIT_INTERVAL;
+    int queue_policy = LOAN_QUEUE_AGE;
+    double interest_pct = 0;
+    int accrual_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:n:c:s:b:g:H:u:T:A:q:I:j:h")) != -1) {
+        switch (opt) {
+            case 'm':
+                if (strcmp(optarg, "fork") == 0) mode = MODE_FORK;
+                else if (strcmp(optarg, "event") == 0) mode = MODE_EVENT;
+                else if (strcmp(optarg, "prefork") == 0) mode = MODE_PREFORK;
+                else { usage(argv[0]); exit(EXIT_FAILURE); }
+                break;
+            case 'n':
+                pool_size = atoi(optarg);
+                if (pool_size < 1) { usage(argv[0]); exit(EXIT_FAILURE); }
+                break;
+            case 'c':
+                max_conns = atoi(optarg);
+                if (max_conns < 0) { usage(argv[0]); exit(EXIT_FAILURE); }
+                break;
+            case 's':
+                if (strcmp(optarg, "none") == 0) durability = STORE_SYNC_NONE;
+                else if (strcmp(optarg, "async") == 0) durability = STORE_SYNC_ASYNC;
+                else if (strcmp(optarg, "sync") == 0) durability = STORE_SYNC_FULL;
+                else { usage(argv[0]); exit(EXIT_FAILURE); }
+                break;
+            case 'b':
+                if (atoi(optarg) < 1) { usage(argv[0]); exit(EXIT_FAILURE); }
+                id_set_block_size(atoi(optarg));
+                break;
+            case 'g':
+                commit_window = atoi(optarg);
+                if (commit_window < 0) { usage(argv[0]); exit(EXIT_FAILURE); }
+                break;
+            case 'H':
+                strncpy(hot_list, optarg, sizeof(hot_list) - 1);
+                break;
+            case 'u':
+                unix_path = optarg;
+                break;
+            case 'T':
+                session_ttl = atoi(optarg);
+                if (session_ttl < 0) { usage(argv[0]); exit(EXIT_FAILURE); }
+                break;
+            case 'A':
+                audit_interval = atoi(optarg);
+                if (audit_interval < 0) { usage(argv[0]); exit(EXIT_FAILURE); }
+                break;
+            case 'q':
+                if (strcmp(optarg, "age") == 0) queue_policy = LOAN_QUEUE_AGE;
+                else if (strcmp(optarg, "amount") == 0) queue_policy = LOAN_QUEUE_AMOUNT;
+                else { usage(argv[0]); exit(EXIT_FAILURE); }
+                break;
+            case 'I':
+                interest_pct = atof(optarg);
+                if (interest_pct < 0 || interest_pct > 100) { usage(argv[0]); exit(EXIT_FAILURE); }
+                break;
+            case 'j':
+                accrual_workers = atoi(optarg);
+                if (accrual_workers < 1) { usage(argv[0]); exit(EXIT_FAILURE); }
+                break;
+            default:
+                usage(argv[0]);
+                exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
     // Set up signal handler for zombie processes
     struct sigaction sa;
-    sa.sa_handler = sigchld_handler; 
+    sa.sa_handler = sigchld_handler;
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = SA_RESTART;
     if (sigaction(SIGCHLD, &sa, NULL) == -1) {
         perror("sigaction");
         exit(EXIT_FAILURE);
     }
-    
-    // 1. Create Socket 
+    signal(SIGPIPE, SIG_IGN); // A vanished client must not kill a process serving others
+
+    if (lock_table_open() == -1) {
+        perror("[SERVER] Record lock table setup failed");
+        exit(EXIT_FAILURE);
+    }
+    if (stats_open() == -1) {
+        perror("[SERVER] Statistics table setup failed");
+        exit(EXIT_FAILURE);
+    }
+    if (session_table_open(session_ttl) == -1) {
+        perror("[SERVER] Session table setup failed");
+        exit(EXIT_FAILURE);
+    }
+    if (hot_accounts_open(strstr(hot_list, "auto") != NULL) == -1) {
+        perror("[SERVER] Hot account table setup failed");
+        exit(EXIT_FAILURE);
+    }
+    for (char *item = strtok(hot_list, ","); item != NULL; item = strtok(NULL, ",")) {
+        if (strcmp(item, "auto") == 0 || strcmp(item, "none") == 0) continue;
+        if (atoi(item) < 1 || hot_account_add(atoi(item), 1) == -1) {
+            fprintf(stderr, "[SERVER] Bad hot account: %s\n", item);
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Map accounts.dat once here; every child and worker inherits the mapping
+    if (store_open(durability) == -1) {
+        perror("[SERVER] Account store open failed");
+        exit(EXIT_FAILURE);
+    }
+    if (user_index_open() == -1) {
+        perror("[SERVER] Username index open failed");
+        exit(EXIT_FAILURE);
+    }
+    if (id_allocator_open() == -1) {
+        perror("[SERVER] ID allocator open failed");
+        exit(EXIT_FAILURE);
+    }
+    // Replays balances.wal into accounts.dat before any request is served
+    if (wal_open(commit_window) == -1) {
+        perror("[SERVER] Write-ahead log open failed");
+        exit(EXIT_FAILURE);
+    }
+    if (loan_index_open() == -1) {
+        perror("[SERVER] Loan index open failed");
+        exit(EXIT_FAILURE);
+    }
+    loan_queue_set_policy(queue_policy);
+    if (loan_queue_load_employees() == -1) {
+        perror("[SERVER] Loan assignment setup failed");
+        exit(EXIT_FAILURE);
+    }
+    if (journal_open() == -1) {
+        perror("[SERVER] Transaction journal open failed");
+        exit(EXIT_FAILURE);
+    }
+    if (accrual_open() == -1) {
+        perror("[SERVER] Interest accrual setup failed");
+        exit(EXIT_FAILURE);
+    }
+
+    struct sigaction sa_stats;
+    sa_stats.sa_handler = stats_handler;
+    sigemptyset(&sa_stats.sa_mask);
+    sa_stats.sa_flags = 0; // Interrupt accept/epoll_wait/waitpid so the dump happens promptly
+    sigaction(SIGUSR1, &sa_stats, NULL);
+
+    if (unix_path != NULL) {
+        unix_sd = open_unix_listener(unix_path, (mode == MODE_FORK) ? BACKLOG : EVENT_BACKLOG);
+        if (unix_sd < 0) {
+            perror("[SERVER] Local socket setup failed");
+            exit(EXIT_FAILURE);
+        }
+        printf("[SERVER] Also listening on local socket %s\n", unix_path);
+    }
+    if (audit_interval > 0) spawn_loan_auditor(audit_interval);
+    spawn_accrual_runner(interest_pct, (accrual_workers > 0) ? accrual_workers : 1);
+
+    if (mode == MODE_PREFORK) {
+        // Bind once without listening to report a busy port before any worker starts
+        listen_sd = open_listener(1, 0);
+        if (listen_sd < 0) {
+            perror("[SERVER] Bind failed");
+            exit(EXIT_FAILURE);
+        }
+        sys_close(listen_sd);
+        printf("[SERVER] Banking Server listening on port %d (prefork mode, %d workers)...\n", PORT, pool_size);
+        fflush(stdout); // Workers inherit stdio buffers across fork
+        run_prefork_master(pool_size, unix_sd, max_conns);
+        return 0;
+    }
+
+    // 1. Create Socket
     listen_sd = sys_socket(AF_INET, SOCK_STREAM, 0);
     if (listen_sd < 0) {
         perror("[SERVER] Socket creation failed");
         exit(EXIT_FAILURE);
     }
-    
+
     // Configure server address
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
     server_addr.sin_port = htons(PORT);
-    
+
     // 2. Bind Socket
     if (sys_bind(listen_sd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
         perror("[SERVER] Bind failed");
         sys_close(listen_sd);
         exit(EXIT_FAILURE);
     }
-    
-    // 3. Listen 
-    if (sys_listen(listen_sd, BACKLOG) < 0) {
+
+    // 3. Listen
+    if (sys_listen(listen_sd, (mode == MODE_EVENT) ? EVENT_BACKLOG : BACKLOG) < 0) {
         perror("[SERVER] Listen failed");
         sys_close(listen_sd);
         exit(EXIT_FAILURE);
     }
 
-    printf("[SERVER] Banking Server listening on port %d...\n", PORT);
+    printf("[SERVER] Banking Server listening on port %d (%s mode)...\n", PORT,
+           (mode == MODE_EVENT) ? "event" : "fork");
+
+    if (mode == MODE_EVENT) {
+        run_event_loop(listen_sd, unix_sd, 0);
+        return 0;
+    }
+
+    struct pollfd listeners[2] = { { listen_sd, POLLIN, 0 }, { unix_sd, POLLIN, 0 } };
 
     // Main loop to accept new clients
     while (1) {
-        // 4. Accept connection 
-        client_sd = sys_accept(listen_sd, (struct sockaddr *)&client_addr, &client_len);
+        // 4. Accept connection (from whichever listener is ready)
+        if (poll(listeners, (unix_sd >= 0) ? 2 : 1, -1) < 0) {
+            if (errno == EINTR && stats_requested) print_stats();
+            continue;
+        }
+        int ready_sd = (listeners[0].revents & POLLIN) ? listen_sd : unix_sd;
+        client_len = sizeof(client_addr);
+        client_sd = sys_accept(ready_sd, (struct sockaddr *)&client_addr, &client_len);
         if (client_sd < 0) {
-            if (errno == EINTR) continue; 
+            if (errno == EINTR) {
+                if (stats_requested) print_stats();
+                continue;
+            }
             perror("[SERVER] Accept failed");
             continue;
         }
-        
-        printf("[SERVER] Connection accepted from %s:%d\n", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+
+        print_accepted(&client_addr);
 
         // 5. Fork a new process (Concurrency)
         pid_t pid = fork();
-        
+
         if (pid < 0) {
             perror("[SERVER] Fork failed");
             sys_close(client_sd);
         } else if (pid == 0) {
             // Child Process: Handle the client connection
-            sys_close(listen_sd); 
+            sys_close(listen_sd);
+            if (unix_sd >= 0) sys_close(unix_sd);
+            id_reset_blocks();
+            signal(SIGUSR1, SIG_IGN); // Stats dumps are the master's job
             handle_client(client_sd);
         } else {
             // Parent Process: Close the client socket and wait for the next connection
-            sys_close(client_sd); 
+            sys_close(client_sd);
         }
     }
 
     sys_close(listen_sd);
     return 0;
-}
\ No newline at end of file
+}
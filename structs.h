@@ -15,6 +15,13 @@
 #define LOAN_APPROVED 3
 #define LOAN_REJECTED 4
 
+// Transaction Types
+#define TXN_DEPOSIT 1
+#define TXN_WITHDRAW 2
+#define TXN_TRANSFER_OUT 3
+#define TXN_TRANSFER_IN 4
+#define TXN_INTEREST 5
+
 // User Status
 #define ACTIVE 1
 #define DEACTIVATED 0
@@ -39,16 +46,19 @@ struct Account {
     int id; // Same as User ID
     double balance;
     int status; // 1: Active, 0: Deactivated
+    int accrued_through; // Business day (YYYYMMDD) of the last interest credit (fills what was padding)
 };
 
 // Structure for Transactions
 struct Transaction {
     int id; // Unique Transaction ID
     int account_id;
-    int type; // 1: Deposit, 2: Withdraw, 3: Transfer Out, 4: Transfer In
+    int type; // 1: Deposit, 2: Withdraw, 3: Transfer Out, 4: Transfer In, 5: Interest
     double amount;
     int target_account_id; // Used for transfers
-    // In a real system, we'd add a timestamp, but we'll keep it simple for now.
+    long long timestamp; // Microseconds since the Unix epoch
+    int prev_id; // Previous transaction of the same account (0 = oldest)
+    int skip_id; // Latest checkpoint of the same account before this one (see utils.c IX)
 };
 
 // Inter-Process Communication Message Structure
@@ -60,6 +70,7 @@ struct Message {
     char data[256]; // Generic field for username, password, feedback text, etc.
     struct Account account_data; // For sending account info back
     int success_status; // 1 for success, 0 for failure
+    unsigned int request_id; // Correlation ID, echoed in the reply (fills what was padding)
 };
 
 // Structure for Loan Applications
@@ -85,9 +96,170 @@ struct Loan {
 #define CMD_VIEW_LOAN_STATUS 9  // Customer Option (New - for applied loans)
 #define CMD_PROCESS_LOAN 10     // Employee Option 3/4
 #define CMD_VIEW_ASSIGNED_LOANS 11 // Employee Option 5
+#define CMD_VIEW_HISTORY 12     // Customer Option 7, Employee Option 6
+#define CMD_STATS 13            // Administrator Option 4
+#define CMD_LOCK_STATS 14       // Administrator Option 5
+#define CMD_BATCH_TRANSFER 15   // Customer Option 8
+#define CMD_HELLO 16            // Wire protocol negotiation, right after connecting
+#define CMD_RING_ATTACH 17      // Move an AF_UNIX connection onto a shared-memory ring
+#define CMD_RESUME 18           // Log a new connection in with a session token
+#define CMD_SET_ACCOUNT_STATUS 19 // Manager Option 1
+#define CMD_ASSIGN_LOANS 20     // Manager Option 2
+#define CMD_CLAIM_LOAN 21       // Employee Option 3 (loan ID 0 = next in the work queue)
+#define CMD_LIST_LOANS 22       // Employee Option 5 (after the summary)
+#define CMD_ACCRUE_INTEREST 23  // Administrator Option 6
 #define CMD_LOGOUT 99
 
-// Global variables for the current session (Declared here, Defined in utils.c)
+// CMD_HELLO picks the wire protocol. The request is always a fixed struct Message with
+// target_id = the newest protocol version the client speaks; a successful reply carries
+// the version granted, and every later frame in both directions uses it. A client that
+// never says hello (or whose server fails it) stays on version 0.
+#define WIRE_FIXED 0              // One whole struct Message per request and reply
+#define WIRE_COMPACT 1            // Length-prefixed frames with per-command fields (utils.c XIII)
+#define WIRE_VERSION WIRE_COMPACT // Newest version this build speaks
+
+// CMD_RING_ATTACH is sent over an AF_UNIX connection with RING_FDS descriptors attached
+// (SCM_RIGHTS, see utils.c XIV). Its reply still comes on the socket; every later
+// request and reply travels through the shared rings, and closing the socket ends the
+// session.
+
+// A successful CMD_LOGIN reply carries a session token in data (SESSION_TOKEN_LEN hex
+// characters). CMD_RESUME sends it back in data on a later connection; the reply is
+// that of a login, with target_id = the role. Tokens expire after a period unused, at
+// logout, and when a manager deactivates the customer's account.
+#define SESSION_TOKEN_LEN 32
+
+// CMD_SET_ACCOUNT_STATUS: source_id is the customer's account, target_id ACTIVE or
+// DEACTIVATED.
+
+// Applied loans wait in a work queue. CMD_ASSIGN_LOANS hands up to target_id of them
+// (0 = all) to employees, each to whoever has the fewest open loans; the reply's
+// target_id is how many. CMD_CLAIM_LOAN gives the employee the next loan assigned to
+// them, or else the next unassigned one: reply target_id = loan ID (0 if none),
+// source_id = customer, amount = loan amount.
+
+// CMD_ACCRUE_INTEREST starts the end-of-day interest run: amount = annual rate in
+// percent, target_id = business day as YYYYMMDD (0 = today); the reply's target_id is
+// the day queued. The run goes on in the background. With amount 0 the reply describes
+// the latest run in data, with target_id = its day, source_id = chunks done and amount =
+// interest credited.
+
+// CMD_VIEW_LOAN_STATUS replies with a struct Message (target_id = records that follow,
+// source_id = loans the customer has in all) followed by the customer's newest loans as
+// struct Loan records, at most LOAN_STATUS_MAX_RECORDS of them.
+#define LOAN_STATUS_MAX_RECORDS 256
+
+// CMD_VIEW_HISTORY pages, newest first: request source_id is the account, target_id the
+// cursor (0 = start) and data an optional struct HistoryRange. The reply is a struct
+// Message (target_id = records that follow, source_id = next cursor, 0 at the end)
+// followed by that many struct Transaction records.
+#define HISTORY_PAGE_RECORDS 64
+
+struct HistoryRange {
+    long long from; // Oldest timestamp to include, 0 = unbounded
+    long long to;   // Newest timestamp to include, 0 = unbounded
+};
+
+// CMD_LIST_LOANS pages through the loans in one status, optionally of one assignee, in
+// the order they entered that status: request data is a struct LoanQuery. The reply is
+// a struct Message (target_id = records that follow, source_id and amount = the next
+// cursor_id and cursor_seq, source_id 0 at the end) followed by that many struct Loan
+// records.
+#define LOAN_PAGE_RECORDS 256
+#define LOAN_ANY_ASSIGNEE -1
+
+struct LoanQuery {
+    int status;              // LOAN_APPLIED..LOAN_REJECTED
+    int assignee;            // processed_by_id to match (0 = unassigned) or LOAN_ANY_ASSIGNEE
+    int cursor_id;           // 0 = from the start
+    unsigned int cursor_seq;
+};
+
+// CMD_STATS replies with a struct Message (target_id = records that follow) followed by
+// one struct CommandStats per command the server has served since startup. Latencies
+// are server-side time from dispatch to the reply being queued.
+struct CommandStats {
+    int command;
+    int reserved;
+    unsigned long long count;
+    unsigned long long errors;       // Requests answered with success_status == 0
+    unsigned long long bytes_in;
+    unsigned long long bytes_out;
+    unsigned long long lock_wait_ns; // Time spent waiting for record locks held by others
+    unsigned long long lock_waits;
+    unsigned long long total_ns;
+    unsigned long long max_ns;
+    unsigned long long p50_ns;
+    unsigned long long p90_ns;
+    unsigned long long p99_ns;
+    unsigned long long p999_ns;
+};
+
+// CMD_LOCK_STATS replies with a struct Message (source_id = struct LockSpaceStats records,
+// target_id = struct LockHotspot records) followed by the totals of each lock space
+// (0 = accounts, 1 = users, 2 = loans) and then the most contended records of each space,
+// most waited-for first.
+#define LOCK_HOTSPOTS_REPORTED 16 // Hot records per space in a CMD_LOCK_STATS reply
+
+struct LockSpaceStats {
+    int space;
+    int reserved;
+    unsigned long long acquisitions; // Every record lock taken
+    unsigned long long contended;    // Those that found the lock taken and waited
+    unsigned long long wait_ns;      // Total time spent waiting
+};
+
+struct LockHotspot {
+    int space;
+    int record;                      // Account, user or loan ID
+    unsigned long long wait_ns;      // Estimated total wait; overestimates by at most error_ns
+    unsigned long long error_ns;
+    unsigned long long waits;        // Contended acquisitions since the record was tracked
+};
+
+// CMD_BATCH_TRANSFER pays many accounts from the caller's account in one atomic step.
+// The legs travel as struct TransferLeg records in request data, BATCH_FRAME_LEGS per
+// frame; every frame carries target_id = legs in the whole batch, and the server takes
+// min(BATCH_FRAME_LEGS, legs still missing) from each. Only the frame completing the
+// batch is answered: a struct Message (target_id = legs that follow, amount = total
+// debited, account_data = the source afterwards) followed by the legs with status set.
+// One bad leg or insufficient funds fails the whole batch, and the statuses say why.
+#define BATCH_MAX_LEGS 8191 // The debit and every credit share one WAL record
+#define BATCH_FRAME_LEGS (int)(sizeof(((struct Message *)0)->data) / sizeof(struct TransferLeg))
+
+#define LEG_OK 0
+#define LEG_PENDING 1           // Valid, but the batch failed for another reason
+#define LEG_NO_ACCOUNT 2
+#define LEG_BAD_AMOUNT 3
+#define LEG_SELF 4              // Target is the source account
+
+struct TransferLeg {
+    int target_id;
+    int status;
+    double amount;
+};
+
+struct RingEnd;
+
+// Per-connection session state. The server keeps one per client connection
+// (one per child in fork mode, many per process in event mode).
+struct Session {
+    int client_sd;
+    int protocol;              // WIRE_FIXED until CMD_HELLO negotiates another version
+    struct RingEnd *ring;      // Transport after CMD_RING_ATTACH, NULL while on the socket
+    struct RingEnd *ring_pending; // Attached; takes over once the attach reply is flushed
+    int passed_fds[3];         // Descriptors received for CMD_RING_ATTACH (RING_FDS)
+    int npassed;
+    int logged_in;
+    struct User user;
+    char token[SESSION_TOKEN_LEN + 1]; // Issued at login or resumed; empty if none
+    struct TransferLeg *batch; // CMD_BATCH_TRANSFER legs received so far, NULL if none open
+    int batch_total;
+    int batch_received;
+};
+
+// Client-side logged-in user (Declared here, Defined in utils.c).
+// The server never uses this; it works on a struct Session per connection.
 extern struct User current_user;
 
 #endif
\ No newline at end of file
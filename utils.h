@@ -5,6 +5,10 @@
 
 #include <unistd.h>
 #include <sys/socket.h> // For socketlen_t and sockaddr structures
+#include <sys/stat.h>   // For struct stat
+#include <stdint.h>     // For uint64_t
+#include <sys/uio.h>    // For struct iovec
+#include <time.h>       // For struct timespec
 #include "structs.h"
 
 // --- File I/O System Call Wrappers ---
@@ -13,6 +17,16 @@ ssize_t sys_read(int fd, void *buf, size_t count);
 ssize_t sys_write(int fd, const void *buf, size_t count);
 off_t sys_lseek(int fd, off_t offset, int whence);
 int sys_close(int fd);
+ssize_t sys_pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t sys_pwrite(int fd, const void *buf, size_t count, off_t offset);
+int sys_fstat(int fd, struct stat *st);
+int sys_fdatasync(int fd);
+int sys_msync(void *addr, size_t length, int flags);
+ssize_t sys_writev(int fd, const struct iovec *iov, int iovcnt);
+
+#ifdef COUNT_SYSCALLS
+extern uint64_t sys_call_count; // Calls made through the sys_* wrappers (benchmark builds)
+#endif
 
 // --- Socket System Call Wrappers ---
 int sys_socket(int domain, int type, int protocol);
@@ -20,13 +34,39 @@ int sys_bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
 int sys_listen(int sockfd, int backlog);
 int sys_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 int sys_connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
+ssize_t sys_sendmsg(int sockfd, const struct msghdr *msg, int flags);
+ssize_t sys_recvmsg(int sockfd, struct msghdr *msg, int flags);
+
+// --- Synchronization: Shared-Memory Record Locks (Defined in utils.c) ---
+#define LOCK_ACCOUNTS 0 // Lock spaces; a record is locked by its ID within its space
+#define LOCK_USERS 1
+#define LOCK_LOANS 2
+#define LOCK_SPACES 3
 
-// --- Synchronization: File Locking Wrappers ---
-int sys_lock_record(int fd, int record_index, int type); // Type: F_RDLCK or F_WRLCK
-int sys_unlock_record(int fd, int record_index);
+int lock_table_open(void); // Before fork, so every server process shares the table
+void lock_reap_process(pid_t pid);
+int sys_lock_record(int space, int record_index, int type); // Type: F_RDLCK or F_WRLCK
+int sys_unlock_record(int space, int record_index);
+int sys_lock_record_pair(int space, int record_a, int record_b, int type);
+int sys_lock_record_pair_types(int space, int record_a, int type_a, int record_b, int type_b);
+int sys_lock_record_set(int space, const int *records, const int *types, int n);
+int sys_unlock_record_set(int space, const int *records, int n);
+int sys_unlock_record_pair(int space, int record_a, int record_b);
+long sys_futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout);
+int lock_profile_snapshot(int space, struct LockSpaceStats *totals, struct LockHotspot *out, int max);
+const char *lock_space_name(int space);
+
+// --- Reply Path (the server queues replies via the hook; without one they are written directly) ---
+typedef ssize_t (*reply_hook_t)(int client_sd, const void *buf, size_t len);
+void set_reply_hook(reply_hook_t hook);
+void set_reply_request_id(unsigned int request_id);
+void set_reply_protocol(int protocol);
+ssize_t send_response(int client_sd, struct Message *response);
+ssize_t send_response_records(int client_sd, struct Message *response, const void *records, size_t len);
 
 // --- Server Service Functions (Defined in utils.c, Called from server.c) ---
-int authenticate_and_set_user(char *username, char *password, int expected_role);
+int authenticate_and_set_user(struct Session *session, char *username, char *password, int expected_role);
+int resume_and_set_user(struct Session *session, const char *token);
 void serve_view_balance(int client_sd, struct Message *request);
 void serve_deposit(int client_sd, struct Message *request);
 void serve_withdraw(int client_sd, struct Message *request);
@@ -37,6 +77,156 @@ void serve_apply_loan(int client_sd, struct Message *request);
 void serve_process_loan(int client_sd, struct Message *request);
 void serve_view_loan_status(int client_sd, struct Message *request);
 void serve_view_assigned_loans(int client_sd, struct Message *request);
+void serve_view_history(int client_sd, struct Message *request);
+void serve_batch_transfer(struct Session *session, struct Message *request);
+void batch_discard(struct Session *session);
+void serve_set_account_status(int client_sd, struct Message *request);
+void serve_assign_loans(int client_sd, struct Message *request);
+void serve_claim_loan(int client_sd, struct Message *request);
+void serve_list_loans(int client_sd, struct Message *request);
+void serve_accrue_interest(int client_sd, struct Message *request);
+
+// --- Account Store: accounts.dat mapped into memory (Defined in utils.c) ---
+// Durability policies for in-place balance updates
+#define STORE_SYNC_NONE 0  // Kernel writeback only
+#define STORE_SYNC_ASYNC 1 // msync(MS_ASYNC) the touched page after each update
+#define STORE_SYNC_FULL 2  // msync(MS_SYNC) the touched page after each update
+
+int store_open(int durability);
+int store_fd(void);
+struct Account *store_get(int id);
+void store_sync(struct Account *acc);
+void store_sync_range(struct Account *first, int count);
+int store_append(struct Account *acc);
+int store_flush(void);
+
+// --- Username Index: users.idx hash table over users.dat (Defined in utils.c) ---
+int user_index_open(void);
+int user_index_lookup(const char *username, struct User *out);
+int user_index_lock(void);   // Serializes users.dat appends and index updates across processes
+void user_index_unlock(void);
+int users_fd(void);          // users.dat, opened by the index; holds its lock
+int user_index_insert(const char *username, int record);
+int user_index_remove(const char *username);
+
+// --- ID Allocator: shared sequence counters in ids.seq (Defined in utils.c) ---
+#define SEQ_USER 0  // User IDs (also the customer's account ID)
+#define SEQ_LOAN 1  // Loan IDs
+#define SEQ_TXN 2   // Transaction IDs (also the record's slot in the journal)
+#define SEQ_COUNT 3
+
+int id_allocator_open(void);
+void id_set_block_size(int block_size);
+void id_set_sequence_block_size(int seq, int block_size);
+void id_raise(int seq, uint64_t floor);
+uint64_t id_reserve(int seq, uint64_t count);
+uint64_t id_next(int seq);
+void id_reset_blocks(void);
+int get_next_user_id();
+int get_next_loan_id();
+
+// --- Write-Ahead Log: balance changes with group commit (Defined in utils.c) ---
+#define WAL_LEG_IMAGE 1 // WalLeg.balance holds the resulting balance
+#define WAL_LEG_ACCRUAL 2 // Interest credit; account_id 0 marks the record's business day in delta
+
+struct WalLeg {
+    int account_id;
+    int flags;
+    double delta;   // Signed change applied to the balance
+    double balance; // Balance after the change (valid with WAL_LEG_IMAGE)
+};
+
+struct WalStats {
+    uint64_t commits;        // Commit requests (one per successful balance operation)
+    uint64_t fsyncs;         // fdatasync calls that served them
+    uint64_t fsync_ns_total; // Total and worst fdatasync latency
+    uint64_t fsync_ns_max;
+    uint64_t checkpoints;
+};
+
+int wal_open(int window_usec);
+void wal_set_deferred(int deferred);
+int wal_log(const struct WalLeg *legs, int nlegs, uint64_t *lsn);
+int wal_commit(uint64_t lsn);
+int wal_sync_pending(void);
+void wal_get_stats(struct WalStats *out);
+
+// --- Hot Accounts: coalesced credits to contended accounts (Defined in utils.c) ---
+struct HotAccountStats {
+    int account_id;
+    int designated;     // Named with -H rather than auto-detected
+    double pending;     // Credits not yet merged into the stored balance
+    uint64_t credits;   // Credits coalesced since the account turned hot
+    uint64_t merges;
+};
+
+int hot_accounts_open(int auto_detect); // Before fork, so every server process shares the buffers
+int hot_account_add(int account_id, int designated);
+int hot_account(int account_id);
+double account_balance(const struct Account *acc);
+void hot_credit(int account_id, double amount);
+void hot_settle(int account_id);
+int hot_merge_due(int account_id);
+void hot_merge(int account_id);
+int hot_accounts_snapshot(struct HotAccountStats *out, int max);
+
+// --- Session Tokens: resumable logins shared by every server process (Defined in utils.c) ---
+int session_table_open(int ttl_sec); // Before fork; ttl_sec = 0 issues no tokens
+int session_token_issue(const struct User *user, char *token);
+int session_token_resume(const char *token, struct User *user);
+void session_token_revoke(const char *token);
+int session_tokens_revoke_user(int user_id);
+
+// --- Loan Index: each customer's loans, chained through loans.idx, and loan counters (Defined in utils.c) ---
+int loan_index_open(void); // Before fork, so every server process shares the mutex
+int loans_fd(void);
+int loan_read(int id, struct Loan *out);
+int loan_index_link(const struct Loan *loan);
+int loans_of_customer(int customer_id, struct Loan *out, int max, int *total);
+void loan_counters_begin(void); // Bracket every loan write, under its record lock
+void loan_counters_end(int loan_id, int old_status, int old_processor, int new_status, int new_processor);
+int loans_in_status(int status);
+int loans_processed_by(int employee_id);
+int loan_counters_audit(void);  // Recount loans.dat; returns counters repaired
+
+// --- Loan Work Queues: applied loans waiting for an employee (Defined in utils.c) ---
+#define LOAN_QUEUE_AGE 0    // Unassigned loans go out oldest first
+#define LOAN_QUEUE_AMOUNT 1 // Largest amount tier first, oldest first within it
+void loan_queue_set_policy(int policy);
+int loan_queue_add_employee(int employee_id);
+int loan_queue_load_employees(void);
+void loan_queue_push(const struct Loan *loan);
+void loan_queue_remove(int loan_id);
+int loan_queue_take(int employee_id, int *queue);
+int loan_queue_take_for_assignment(int *employee_id, int *queue);
+void loan_queue_requeue(int loan_id, double amount, int employee_id);
+void loan_queue_put_back(int loan_id, int queue);
+int loans_backlog_of(int employee_id, int *queued);
+int loans_unassigned(void);
+int loan_list_page(struct LoanQuery *query, int *ids, int max);
+
+// --- Interest Accrual: end-of-day batch over accounts.dat (Defined in utils.c) ---
+int accrual_open(void); // Before fork, so the runner and every server process share the controls
+void accrual_runner(double annual_pct, int workers); // In a child of the server; never returns
+
+// --- Transaction Journal: segmented append-only history (Defined in utils.c) ---
+int journal_open(void);
+int journal_append(int account_id, int type, double amount, int target_account_id);
+int journal_flush(void);
+int journal_history(int account_id, int *cursor, long long from, long long to, struct Transaction *out, int max);
+
+// --- Server Statistics: per-command histograms in shared memory (Defined in utils.c) ---
+int stats_open(void); // Before fork, so every server process adds to the same tables
+uint64_t stats_clock(void);
+void stats_record(int command, uint64_t start_ns, size_t bytes_in);
+void stats_note_reply(int success, size_t bytes);
+void stats_add_lock_wait(uint64_t ns);
+void stats_lock_acquired(int space);
+int stats_snapshot(struct CommandStats *out, int max);
+int lock_stats_snapshot(struct LockSpaceStats *spaces, int *nspaces, struct LockHotspot *out, int max_per_space);
+void serve_stats(int client_sd, struct Message *request);
+void serve_lock_stats(int client_sd, struct Message *request);
+const char *command_name(int command);
 
 // --- General Utilities ---
 ssize_t sys_write_string(const char *s);
@@ -44,4 +234,56 @@ int get_input(char *buffer, size_t size);
 void change_password_flow();
 void print_menu(int role);
 
+// --- Compact Wire Protocol: variable-length frames (Defined in utils.c) ---
+#define WIRE_HEADER_MAX 320 // Largest encoded frame before its records
+#define WIRE_REQUEST_MAX ((ssize_t)sizeof(struct Message)) // Longer request frames are rejected
+
+ssize_t wire_frame_size(const void *buf, size_t len);
+size_t wire_encode(const struct Message *m, int reply, size_t records_len, unsigned char *out);
+ssize_t wire_decode(const void *buf, size_t len, int reply, struct Message *m, size_t *records_len);
+ssize_t wire_read_request(const struct Session *session, const void *buf, size_t len, struct Message *request);
+
+// --- Client Pipelining: many requests in flight per connection (Defined in utils.c) ---
+struct Pipeline {
+    int sd;
+    int protocol;          // WIRE_FIXED until pipeline_negotiate() agrees on another
+    struct RingEnd *ring;  // Set by pipeline_attach_ring(); then traffic bypasses sd
+    unsigned int next_id;  // request_id for the next queued request
+    char *out;             // Queued requests
+    size_t out_len, out_cap;
+    char *in;              // Replies read but not yet handed out
+    size_t in_len, in_cap;
+};
+
+// --- Shared-Memory Ring Transport: co-located clients (Defined in utils.c) ---
+#define RING_FDS 3 // Passed with CMD_RING_ATTACH: the mapping, the server's and the client's eventfd
+
+struct RingEnd {
+    struct RingShared *shared;
+    int side;     // Which of the two rings this end reads
+    int wait_fd;  // eventfd this end sleeps on
+    int wake_fd;  // eventfd that wakes the other end
+};
+
+struct RingEnd *ring_create(int fds[RING_FDS]);
+struct RingEnd *ring_attach(int fds[RING_FDS]);
+void ring_detach(struct RingEnd *r);
+ssize_t ring_read(struct RingEnd *r, void *buf, size_t len);
+ssize_t ring_write(struct RingEnd *r, const void *buf, size_t len);
+int ring_idle(struct RingEnd *r, int want_data, int want_space);
+void ring_resume(struct RingEnd *r);
+int ring_spin_limit(int spins);
+int ring_wait(struct RingEnd *r, int sd, int want_data, int want_space);
+ssize_t send_fds(int sd, const void *buf, size_t len, const int *fds, int nfds);
+ssize_t recv_fds(int sd, void *buf, size_t len, int *fds, int max_fds, int *nfds);
+
+size_t reply_records_size(const struct Message *reply);
+void pipeline_init(struct Pipeline *p, int sd);
+void pipeline_free(struct Pipeline *p);
+unsigned int pipeline_queue(struct Pipeline *p, struct Message *request);
+int pipeline_flush(struct Pipeline *p);
+int pipeline_negotiate(struct Pipeline *p);
+int pipeline_attach_ring(struct Pipeline *p);
+ssize_t pipeline_reply(struct Pipeline *p, struct Message *reply, void *records, size_t max);
+
 #endif
\ No newline at end of file